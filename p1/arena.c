@@ -0,0 +1,110 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * arena.c
+ */
+
+#include "arena.h"
+
+#define ALIGN 16
+
+struct chunk {
+	struct chunk *next;
+	size_t size; /* bytes in data */
+	size_t used; /* bytes in data, starting at an ALIGN boundary */
+	double data[1];
+};
+
+struct arena {
+	size_t chunk;
+	struct chunk *head; /* current chunk, followed by older ones */
+};
+
+static size_t
+align(size_t n)
+{
+	return (n + (ALIGN - 1)) & ~(size_t)(ALIGN - 1);
+}
+
+static struct chunk *
+mkchunk(size_t size)
+{
+	struct chunk *chunk;
+	size_t pad;
+
+	pad = align(offsetof(struct chunk, data)) - offsetof(struct chunk, data);
+	if (!(chunk = malloc(offsetof(struct chunk, data) + pad + size))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	chunk->next = NULL;
+	chunk->size = pad + size;
+	chunk->used = pad;
+	return chunk;
+}
+
+struct arena *
+arena_open(size_t chunk)
+{
+	struct arena *arena;
+
+	assert( chunk );
+
+	if (!(arena = malloc(sizeof (struct arena)))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(arena, 0, sizeof (struct arena));
+	arena->chunk = align(chunk);
+	return arena;
+}
+
+void
+arena_close(struct arena *arena)
+{
+	struct chunk *chunk;
+
+	if (arena) {
+		while ((chunk = arena->head)) {
+			arena->head = chunk->next;
+			FREE(chunk);
+		}
+		memset(arena, 0, sizeof (struct arena));
+	}
+	FREE(arena);
+}
+
+void *
+arena_alloc(struct arena *arena, size_t size)
+{
+	struct chunk *chunk;
+	char *p;
+
+	assert( arena );
+
+	size = align(size ? size : 1);
+	chunk = arena->head;
+	if (!chunk || ((chunk->size - chunk->used) < size)) {
+
+		/* oversized requests get a chunk of their own */
+
+		if (!(chunk = mkchunk(MAX(size, arena->chunk)))) {
+			TRACE(0);
+			return NULL;
+		}
+		if (arena->head && (size > arena->chunk)) {
+			chunk->next = arena->head->next;
+			arena->head->next = chunk;
+		}
+		else {
+			chunk->next = arena->head;
+			arena->head = chunk;
+		}
+	}
+	p = (char *)chunk->data + chunk->used;
+	chunk->used += size;
+	return p;
+}
@@ -0,0 +1,50 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * arena.h
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include "system.h"
+
+struct arena;
+
+/**
+ * Opens a bump allocator. Memory is carved sequentially out of large chunks
+ * and only ever released all at once, by arena_close().
+ *
+ * chunk: the size, in bytes, of each chunk requested from malloc()
+ *
+ * return: an opaque handle or NULL on error
+ */
+
+struct arena *arena_open(size_t chunk);
+
+/**
+ * Releases every allocation made from arena, and arena itself.
+ *
+ * arena: an opaque handle previously obtained by calling arena_open()
+ *
+ * Note: arena may be NULL.
+ */
+
+void arena_close(struct arena *arena);
+
+/**
+ * Allocates size bytes, suitably aligned for any type. Consecutive
+ * allocations are adjacent in memory unless a new chunk has to be started.
+ *
+ * arena: an opaque handle previously obtained by calling arena_open()
+ * size : the number of bytes
+ *
+ * return: the memory (not zeroed) or NULL on error
+ */
+
+void *arena_alloc(struct arena *arena, size_t size);
+
+#endif /* _ARENA_H_ */
@@ -0,0 +1,240 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * batch.c
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <unistd.h>
+#include "batch.h"
+
+/**
+ * Needs:
+ *   pthread_create()
+ *   pthread_join()
+ *   pthread_cond_wait()
+ *   sysconf()
+ */
+
+#define CACHE (256 * 1024) /* bytes of columns and results per chunk */
+#define MIN_CHUNK 64 /* rows */
+
+struct job {
+	evaluate_batch_t fnc;
+	const double *const *cols;
+	int ncols;
+	size_t n;
+	double *out;
+	const double **scratch; /* ncols column pointers per thread */
+};
+
+struct worker {
+	struct batch *batch;
+	int index;
+	pthread_t thread;
+	int started;
+};
+
+struct batch {
+	int threads;
+	struct worker *workers; /* workers[0] is the caller */
+	pthread_mutex_t mutex;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	uint64_t generation; /* of job */
+	int pending; /* threads still running job */
+	int stop;
+	struct job job;
+};
+
+/**
+ * Evaluates the slice of the rows owned by thread index, a chunk at a time.
+ */
+
+static void
+slice(const struct job *job, int index, int threads)
+{
+	const double **cols;
+	size_t begin, end, chunk, k;
+	int i;
+
+	begin = job->n / threads * index + MIN(job->n % threads, (size_t)index);
+	end = begin + job->n / threads + (((size_t)index < job->n % threads) ?
+					  1 : 0);
+	chunk = MAX(CACHE / (sizeof (double) * (job->ncols + 1)),
+		    (size_t)MIN_CHUNK);
+	cols = job->scratch + (size_t)index * job->ncols;
+	for (; begin<end; begin+=k) {
+		k = MIN(chunk, end - begin);
+		for (i=0; i<job->ncols; ++i) {
+			cols[i] = job->cols[i] + begin;
+		}
+		job->fnc(cols, k, job->out + begin);
+	}
+}
+
+static void *
+work(void *arg)
+{
+	struct worker *worker;
+	struct batch *batch;
+	uint64_t generation;
+	struct job job;
+
+	worker = (struct worker *)arg;
+	batch = worker->batch;
+	generation = 0;
+	for (;;) {
+		pthread_mutex_lock(&batch->mutex);
+		while (!batch->stop && (generation == batch->generation)) {
+			pthread_cond_wait(&batch->start, &batch->mutex);
+		}
+		if (batch->stop) {
+			pthread_mutex_unlock(&batch->mutex);
+			break;
+		}
+		generation = batch->generation;
+		job = batch->job;
+		pthread_mutex_unlock(&batch->mutex);
+		slice(&job, worker->index, batch->threads);
+		pthread_mutex_lock(&batch->mutex);
+		if (!--batch->pending) {
+			pthread_cond_signal(&batch->done);
+		}
+		pthread_mutex_unlock(&batch->mutex);
+	}
+	return NULL;
+}
+
+struct batch *
+batch_open(int threads)
+{
+	struct batch *batch;
+	long n;
+	int i;
+
+	if (0 >= threads) {
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (0 < n) ? (int)n : 1;
+	}
+	if (!(batch = malloc(sizeof (struct batch)))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(batch, 0, sizeof (struct batch));
+	if (!(batch->workers = malloc(threads * sizeof (batch->workers[0])))) {
+		FREE(batch);
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(batch->workers, 0, threads * sizeof (batch->workers[0]));
+	pthread_mutex_init(&batch->mutex, NULL);
+	pthread_cond_init(&batch->start, NULL);
+	pthread_cond_init(&batch->done, NULL);
+	batch->threads = threads;
+	for (i=0; i<threads; ++i) {
+		batch->workers[i].batch = batch;
+		batch->workers[i].index = i;
+	}
+	for (i=1; i<threads; ++i) {
+		if (pthread_create(&batch->workers[i].thread,
+				   NULL,
+				   work,
+				   &batch->workers[i])) {
+			batch_close(batch);
+			TRACE("pthread_create()");
+			return NULL;
+		}
+		batch->workers[i].started = 1;
+	}
+	return batch;
+}
+
+void
+batch_close(struct batch *batch)
+{
+	int i;
+
+	if (batch) {
+		pthread_mutex_lock(&batch->mutex);
+		batch->stop = 1;
+		pthread_cond_broadcast(&batch->start);
+		pthread_mutex_unlock(&batch->mutex);
+		for (i=1; i<batch->threads; ++i) {
+			if (batch->workers[i].started) {
+				pthread_join(batch->workers[i].thread, NULL);
+			}
+		}
+		pthread_cond_destroy(&batch->done);
+		pthread_cond_destroy(&batch->start);
+		pthread_mutex_destroy(&batch->mutex);
+		FREE(batch->workers);
+		memset(batch, 0, sizeof (struct batch));
+	}
+	FREE(batch);
+}
+
+int
+batch_threads(const struct batch *batch)
+{
+	assert( batch );
+
+	return batch->threads;
+}
+
+int
+batch_evaluate(struct batch *batch,
+	       evaluate_batch_t fnc,
+	       const double *const *cols,
+	       int ncols,
+	       size_t n,
+	       double *out)
+{
+	const double **scratch;
+	int threads;
+
+	assert( batch );
+	assert( fnc );
+	assert( (0 <= ncols) && out );
+
+	/* small batches are not worth waking the pool */
+
+	threads = batch->threads;
+	if (n < (size_t)threads * MIN_CHUNK) {
+		threads = 1;
+	}
+	if (!(scratch = malloc((size_t)(threads * ncols + 1) *
+			       sizeof (scratch[0])))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	batch->job.fnc = fnc;
+	batch->job.cols = cols;
+	batch->job.ncols = ncols;
+	batch->job.n = n;
+	batch->job.out = out;
+	batch->job.scratch = scratch;
+	if (1 == threads) {
+		slice(&batch->job, 0, 1);
+		FREE(scratch);
+		return 0;
+	}
+	pthread_mutex_lock(&batch->mutex);
+	batch->pending = batch->threads - 1;
+	++batch->generation;
+	pthread_cond_broadcast(&batch->start);
+	pthread_mutex_unlock(&batch->mutex);
+	slice(&batch->job, 0, batch->threads);
+	pthread_mutex_lock(&batch->mutex);
+	while (batch->pending) {
+		pthread_cond_wait(&batch->done, &batch->mutex);
+	}
+	pthread_mutex_unlock(&batch->mutex);
+	FREE(scratch);
+	return 0;
+}
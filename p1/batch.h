@@ -0,0 +1,71 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * batch.h
+ */
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include "codegen.h"
+
+struct batch;
+
+/**
+ * Opens a pool of threads for evaluating compiled expressions over many
+ * rows. The calling thread takes part in every batch_evaluate(), so
+ * threads - 1 threads are created.
+ *
+ * threads: the number of threads, or 0 for one per online CPU
+ *
+ * return: an opaque handle or NULL on error
+ */
+
+struct batch *batch_open(int threads);
+
+/**
+ * Closes a previously opened batch handle, stopping its threads.
+ *
+ * batch: an opaque handle previously obtained by calling batch_open()
+ *
+ * Note: batch may be NULL.
+ */
+
+void batch_close(struct batch *batch);
+
+/**
+ * Returns the number of threads of the pool, including the caller's.
+ *
+ * batch: an opaque handle previously obtained by calling batch_open()
+ */
+
+int batch_threads(const struct batch *batch);
+
+/**
+ * Evaluates fnc over n rows. Each thread owns a contiguous slice of the
+ * rows, and so of out, which it walks in chunks small enough for the
+ * chunk's columns and results to stay in cache: the only synchronization
+ * is at the start and the end of the call. Not reentrant: one call at a
+ * time per pool.
+ *
+ * batch: an opaque handle previously obtained by calling batch_open()
+ * fnc  : evaluate_batch() of a loaded module, see jitc_lookup()
+ * cols : cols[i][row] is the value of variable i
+ * ncols: the number of variables
+ * n    : the number of rows
+ * out  : receives the n results
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int batch_evaluate(struct batch *batch,
+		   evaluate_batch_t fnc,
+		   const double *const *cols,
+		   int ncols,
+		   size_t n,
+		   double *out);
+
+#endif /* _BATCH_H_ */
@@ -0,0 +1,407 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * bench.c
+ */
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include "../codegen.h"
+#include "../jitc.h"
+#include "../lexer.h"
+#include "../parser.h"
+#include "../system.h"
+
+/**
+ * Times each phase of the p1 pipeline on synthetic expressions and reports
+ * min/median/p99 per phase, plus throughput in nodes/second (evaluate:
+ * node evaluations/second). Every change to p1 that claims to be faster
+ * should move these numbers.
+ *
+ * usage: bench [-s balanced|left|repeated] [-n leaves] [-i iterations]
+ *              [-O 0|1|2|3]
+ */
+
+#define VARS 8
+#define CALLS 1000 /* evaluate() calls per evaluate sample */
+
+enum phase {
+	PHASE_LEX,
+	PHASE_PARSE,
+	PHASE_GENERATE,
+	PHASE_COMPILE,
+	PHASE_LOAD,
+	PHASE_EVALUATE,
+	PHASE_END
+};
+
+static const char * const PHASES[] = {
+	"lexer_open",
+	"parser_open",
+	"generate",
+	"jitc_compile",
+	"jitc_open",
+	"evaluate"
+};
+
+static const char * const SHAPES[] = { "balanced", "left", "repeated" };
+
+struct buf {
+	char *s;
+	size_t len;
+	size_t cap;
+};
+
+static int
+append(struct buf *buf, const char *format, ...)
+{
+	va_list ap;
+	size_t cap;
+	char *s;
+	int n;
+
+	for (;;) {
+		va_start(ap, format);
+		n = vsnprintf(buf->s + buf->len, buf->cap - buf->len, format, ap);
+		va_end(ap);
+		if ((0 <= n) && ((size_t)n < (buf->cap - buf->len))) {
+			buf->len += (size_t)n;
+			return 0;
+		}
+		cap = buf->cap ? (2 * buf->cap) : 4096;
+		if (!(s = realloc(buf->s, cap))) {
+			TRACE("out of memory");
+			return -1;
+		}
+		buf->s = s;
+		buf->cap = cap;
+	}
+}
+
+static int
+leaf(struct buf *buf, int i)
+{
+	if (!(i % 5)) {
+		return append(buf, "%d.25", 1 + (i % 3));
+	}
+	return append(buf, "x%d", i % VARS);
+}
+
+/**
+ * A complete binary tree of n leaves, fully parenthesized.
+ */
+
+static int
+balanced(struct buf *buf, int first, int n)
+{
+	const char OPS[] = "+*-/";
+
+	if (1 == n) {
+		return leaf(buf, first);
+	}
+	if (append(buf, "(") ||
+	    balanced(buf, first, n / 2) ||
+	    append(buf, "%c", OPS[(first + n) % 4]) ||
+	    balanced(buf, first + n / 2, n - n / 2) ||
+	    append(buf, ")")) {
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * A chain of n leaves, i.e., a left-deep tree as deep as it is long.
+ */
+
+static int
+left(struct buf *buf, int n)
+{
+	const char OPS[] = "+-";
+	int i;
+
+	for (i=0; i<n; ++i) {
+		if ((i && append(buf, "%c", OPS[i % 2])) || leaf(buf, i + 1)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * A sum of n / 3 terms drawn from a handful of distinct subterms, to
+ * exercise sharing.
+ */
+
+static int
+repeated(struct buf *buf, int n)
+{
+	int i, k;
+
+	for (i=0; i<MAX(1, n / 3); ++i) {
+		k = i % 6;
+		if (append(buf,
+			   "%s(x%d*x%d-x%d)",
+			   i ? "+" : "",
+			   k % VARS,
+			   (k + 1) % VARS,
+			   (k + 2) % VARS)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static char *
+generate(const char *shape, int n)
+{
+	struct buf buf;
+	int e;
+
+	memset(&buf, 0, sizeof (struct buf));
+	if (!strcmp(shape, SHAPES[0])) {
+		e = balanced(&buf, 0, n);
+	}
+	else if (!strcmp(shape, SHAPES[1])) {
+		e = left(&buf, n);
+	}
+	else {
+		e = repeated(&buf, n);
+	}
+	if (e) {
+		FREE(buf.s);
+		return NULL;
+	}
+	return buf.s;
+}
+
+static double
+identity(double x)
+{
+	return x;
+}
+
+static int
+cmp(const void *a_, const void *b_)
+{
+	uint64_t a = *(const uint64_t *)a_;
+	uint64_t b = *(const uint64_t *)b_;
+
+	return (a < b) ? -1 : (a > b);
+}
+
+static void
+report(enum phase phase, uint64_t *ns, int n, double work)
+{
+	double median;
+
+	qsort(ns, (size_t)n, sizeof (ns[0]), cmp);
+	median = (double)ns[n / 2];
+	printf("%-12s %12.3f %12.3f %12.3f %14.3g\n",
+	       PHASES[phase],
+	       ns[0] / 1e3,
+	       median / 1e3,
+	       ns[MIN(n - 1, (99 * n) / 100)] / 1e3,
+	       median ? (work / (median / 1e9)) : 0.0);
+}
+
+/**
+ * Runs every phase iterations times on the expression s, filling
+ * ns[phase][iteration].
+ */
+
+static int
+run(const char *s,
+    int iterations,
+    enum jitc_level level,
+    uint64_t *ns[PHASE_END],
+    int *nodes)
+{
+	const struct lexer_token *token;
+	struct parser *parser;
+	struct lexer *lexer;
+	struct jitc *jitc;
+	double x[VARS], r;
+	char pathname[64];
+	evaluate_t fnc;
+	char *source;
+	size_t len;
+	FILE *file;
+	uint64_t t;
+	int i, j, fd;
+
+	for (j=0; j<VARS; ++j) {
+		x[j] = 0.5 + j;
+	}
+	r = 0.0;
+	for (i=0; i<iterations; ++i) {
+		t = ns_time();
+		if (!(lexer = lexer_open(s, safe_strlen(s)))) {
+			TRACE(0);
+			return -1;
+		}
+		while ((token = lexer_next(lexer)) && (LEXER_OP_ != token->op)) {
+		}
+		lexer_close(lexer);
+		ns[PHASE_LEX][i] = ns_time() - t;
+
+		t = ns_time();
+		if (!(parser = parser_open(s))) {
+			TRACE(0);
+			return -1;
+		}
+		ns[PHASE_PARSE][i] = ns_time() - t;
+		*nodes = parser_dag(parser)->id;
+
+		t = ns_time();
+		if (!(file = open_memstream(&source, &len)) ||
+		    codegen(parser_dag(parser), file)) {
+			if (file) {
+				fclose(file);
+				FREE(source);
+			}
+			parser_close(parser);
+			TRACE(0);
+			return -1;
+		}
+		fclose(file);
+		ns[PHASE_GENERATE][i] = ns_time() - t;
+
+		t = ns_time();
+		if ((0 > (fd = jitc_memfd(pathname, sizeof (pathname)))) ||
+		    jitc_compile(source, pathname, level)) {
+			if (0 <= fd) {
+				close(fd);
+			}
+			FREE(source);
+			parser_close(parser);
+			TRACE(0);
+			return -1;
+		}
+		FREE(source);
+		ns[PHASE_COMPILE][i] = ns_time() - t;
+
+		t = ns_time();
+		if (!(jitc = jitc_open(pathname)) ||
+		    !(fnc = (evaluate_t)jitc_lookup(jitc, "evaluate"))) {
+			jitc_close(jitc);
+			close(fd);
+			parser_close(parser);
+			TRACE(0);
+			return -1;
+		}
+		ns[PHASE_LOAD][i] = ns_time() - t;
+
+		t = ns_time();
+		for (j=0; j<CALLS; ++j) {
+			x[j % VARS] += 1e-9;
+			r += fnc(identity, x);
+		}
+		ns[PHASE_EVALUATE][i] = (ns_time() - t) / CALLS;
+
+		jitc_close(jitc);
+		close(fd);
+		parser_close(parser);
+	}
+	if (r != r) {
+		printf("(nan)\n"); /* keeps the evaluations observable */
+	}
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	uint64_t *ns[PHASE_END];
+	const char *shape;
+	int i, n, iterations, nodes, level, e;
+	size_t len;
+	char *s;
+
+	shape = NULL;
+	n = 1000;
+	iterations = 20;
+	level = JITC_O3;
+	for (i=1; (i + 1) < argc; i+=2) {
+		if (!strcmp(argv[i], "-s")) {
+			shape = argv[i + 1];
+		}
+		else if (!strcmp(argv[i], "-n")) {
+			n = atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-i")) {
+			iterations = atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-O")) {
+			level = atoi(argv[i + 1]);
+		}
+		else {
+			break;
+		}
+	}
+	if ((i != argc) ||
+	    (0 >= n) ||
+	    (0 >= iterations) ||
+	    (0 > level) ||
+	    (JITC_END <= level) ||
+	    (shape &&
+	     strcmp(shape, SHAPES[0]) &&
+	     strcmp(shape, SHAPES[1]) &&
+	     strcmp(shape, SHAPES[2]))) {
+		printf("usage: %s [-s balanced|left|repeated] [-n leaves] "
+		       "[-i iterations] [-O 0|1|2|3]\n",
+		       argv[0]);
+		return -1;
+	}
+	memset(ns, 0, sizeof (ns));
+	for (i=0; i<PHASE_END; ++i) {
+		if (!(ns[i] = malloc((size_t)iterations * sizeof (ns[i][0])))) {
+			TRACE("out of memory");
+			return -1;
+		}
+	}
+	e = 0;
+	for (i=0; !e && (i<(int)ARRAY_SIZE(SHAPES)); ++i) {
+		if (shape && strcmp(shape, SHAPES[i])) {
+			continue;
+		}
+		if (!(s = generate(SHAPES[i], n))) {
+			e = -1;
+			break;
+		}
+		len = safe_strlen(s);
+		if ((e = run(s, iterations, level, ns, &nodes))) {
+			FREE(s);
+			break;
+		}
+		printf("%s: %d leaves, %lu bytes, %d nodes, %d iterations, "
+		       "-O%d\n",
+		       SHAPES[i],
+		       n,
+		       (unsigned long)len,
+		       nodes,
+		       iterations,
+		       level);
+		printf("%-12s %12s %12s %12s %14s\n",
+		       "phase", "min us", "median us", "p99 us", "nodes/s");
+		report(PHASE_LEX, ns[PHASE_LEX], iterations, nodes);
+		report(PHASE_PARSE, ns[PHASE_PARSE], iterations, nodes);
+		report(PHASE_GENERATE, ns[PHASE_GENERATE], iterations, nodes);
+		report(PHASE_COMPILE, ns[PHASE_COMPILE], iterations, nodes);
+		report(PHASE_LOAD, ns[PHASE_LOAD], iterations, nodes);
+		report(PHASE_EVALUATE, ns[PHASE_EVALUATE], iterations, nodes);
+		printf("\n");
+		FREE(s);
+	}
+	for (i=0; i<PHASE_END; ++i) {
+		FREE(ns[i]);
+	}
+	if (e) {
+		TRACE(0);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,445 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * cache.c
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "jitc.h"
+#include "cache.h"
+
+/**
+ * Needs:
+ *   mkdir()
+ *   opendir()
+ *   readdir()
+ *   stat()
+ *   rename()
+ *   utimensat()
+ */
+
+/**
+ * Each module X.so has its key next to it in X.key: the host CPU, the gcc
+ * flags and the C source, verbatim. X is a 128-bit hash of the key, and a
+ * hit only counts if X.key holds the very same key, so neither a collision
+ * nor a cache directory copied from another machine (-march=native) can
+ * load the wrong code.
+ */
+
+#define SUFFIX ".so"
+#define KEY ".key"
+
+struct cache {
+	uint64_t budget;
+	char *dirname;
+	char *target; /* the host CPU, as -march=native sees it */
+	char pathname[1024];
+};
+
+struct entry {
+	struct timespec mtime;
+	uint64_t size;
+	char name[256];
+};
+
+static uint64_t
+fnv1a(uint64_t h, const void *buf, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	size_t i;
+
+	for (i=0; i<len; ++i) {
+		h ^= p[i];
+		h *= 0x100000001b3;
+	}
+	return h;
+}
+
+/**
+ * A second, independent 64-bit hash, so that names are 128 bits wide.
+ */
+
+static uint64_t
+mix(uint64_t h, const void *buf, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	size_t i;
+
+	for (i=0; i<len; ++i) {
+		h = (h ^ p[i]) * 0x9e3779b97f4a7c15;
+		h ^= h >> 29;
+	}
+	return h;
+}
+
+/**
+ * Returns the key of source compiled at level on this host, see KEY.
+ */
+
+static char *
+key(const struct cache *cache, const char *source, enum jitc_level level)
+{
+	const char *flags;
+	size_t n;
+	char *s;
+
+	flags = jitc_flags(level);
+	n = safe_strlen(cache->target) + safe_strlen(flags) + safe_strlen(source);
+	if (!(s = malloc(n + 3))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	safe_sprintf(s, n + 3, "%s\n%s\n%s", cache->target, flags, source);
+	return s;
+}
+
+/**
+ * Returns the identity of the host CPU that gcc's -march=native resolves
+ * from: vendor, family, model and feature flags of the first CPU listed in
+ * /proc/cpuinfo.
+ */
+
+static char *
+target(void)
+{
+	const char * const FIELDS[] = {
+		"vendor_id",
+		"cpu family",
+		"model\t",
+		"flags"
+	};
+	char *line, *s, *tmp;
+	size_t cap, len, n;
+	FILE *file;
+	int i;
+
+	if (!(s = malloc(1))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	s[0] = '\0';
+	n = 0;
+	if (!(file = fopen("/proc/cpuinfo", "r"))) {
+		return s; /* no -march=native to speak of either */
+	}
+	line = NULL;
+	cap = 0;
+	while ((0 < getline(&line, &cap, file)) && ('\n' != line[0])) {
+		for (i=0; i<(int)ARRAY_SIZE(FIELDS); ++i) {
+			if (strncmp(line, FIELDS[i], strlen(FIELDS[i]))) {
+				continue;
+			}
+			len = safe_strlen(line);
+			if (!(tmp = realloc(s, n + len + 1))) {
+				FREE(line);
+				FREE(s);
+				fclose(file);
+				TRACE("out of memory");
+				return NULL;
+			}
+			s = tmp;
+			memcpy(s + n, line, len + 1);
+			n += len;
+		}
+	}
+	FREE(line);
+	fclose(file);
+	return s;
+}
+
+/**
+ * Returns whether the key file at pathname holds exactly key.
+ */
+
+static int
+verify(const char *pathname, const char *key)
+{
+	size_t len, off;
+	struct stat st;
+	ssize_t k;
+	char *buf;
+	int fd, e;
+
+	len = safe_strlen(key);
+	if ((0 > (fd = open(pathname, O_RDONLY))) ||
+	    fstat(fd, &st) ||
+	    ((uint64_t)st.st_size != (uint64_t)len) ||
+	    !(buf = malloc(len + 1))) {
+		if (0 <= fd) {
+			close(fd);
+		}
+		return 0;
+	}
+	for (off=0; off<len; off+=(size_t)k) {
+		if (0 >= (k = read(fd, buf + off, len - off))) {
+			break;
+		}
+	}
+	e = (off == len) && !memcmp(buf, key, len);
+	FREE(buf);
+	close(fd);
+	return e;
+}
+
+/**
+ * Writes key to a fresh temporary file next to pathname, then renames it
+ * into place.
+ */
+
+static int
+store(const char *pathname, const char *key)
+{
+	size_t len, off;
+	char tmp[1024];
+	ssize_t k;
+	int fd;
+
+	safe_sprintf(tmp, sizeof (tmp), "%s.XXXXXX", pathname);
+	if (0 > (fd = mkstemp(tmp))) {
+		TRACE("mkstemp()");
+		return -1;
+	}
+	len = safe_strlen(key);
+	for (off=0; off<len; off+=(size_t)k) {
+		if (0 >= (k = write(fd, key + off, len - off))) {
+			break;
+		}
+	}
+	if (close(fd) || (off != len) || rename(tmp, pathname)) {
+		file_delete(tmp);
+		TRACE("write()");
+		return -1;
+	}
+	return 0;
+}
+
+static int
+entry_cmp(const void *a_, const void *b_)
+{
+	const struct entry *a = (const struct entry *)a_;
+	const struct entry *b = (const struct entry *)b_;
+
+	if (a->mtime.tv_sec != b->mtime.tv_sec) {
+		return (a->mtime.tv_sec < b->mtime.tv_sec) ? -1 : +1;
+	}
+	if (a->mtime.tv_nsec != b->mtime.tv_nsec) {
+		return (a->mtime.tv_nsec < b->mtime.tv_nsec) ? -1 : +1;
+	}
+	return 0;
+}
+
+/**
+ * Evicts the least recently used modules until the cache fits its budget.
+ * Recency is the module's mtime, refreshed on every hit, and the size of a
+ * module is that of X.so and X.key together. The module named keep, just
+ * inserted, is never evicted.
+ */
+
+static void
+evict(struct cache *cache, const char *keep)
+{
+	struct entry *entries, *tmp;
+	struct dirent *dirent;
+	uint64_t total;
+	size_t i, n, cap;
+	struct stat st;
+	char buf[1024];
+	size_t len;
+	DIR *dir;
+
+	if (!(dir = opendir(cache->dirname))) {
+		TRACE("opendir()");
+		return;
+	}
+	entries = NULL;
+	total = 0;
+	n = cap = 0;
+	while ((dirent = readdir(dir))) {
+		len = safe_strlen(dirent->d_name);
+		if ((len <= strlen(SUFFIX)) ||
+		    (len >= sizeof (entries[0].name)) ||
+		    strcmp(dirent->d_name + len - strlen(SUFFIX), SUFFIX)) {
+			continue;
+		}
+		safe_sprintf(buf,
+			     sizeof (buf),
+			     "%s/%s",
+			     cache->dirname,
+			     dirent->d_name);
+		if (stat(buf, &st)) {
+			continue;
+		}
+		if (n == cap) {
+			cap = cap ? (2 * cap) : 64;
+			if (!(tmp = realloc(entries, cap * sizeof (tmp[0])))) {
+				TRACE("out of memory");
+				break;
+			}
+			entries = tmp;
+		}
+		entries[n].mtime = st.st_mtim;
+		entries[n].size = (uint64_t)st.st_size;
+
+		/* its key holds the whole source, so it counts too */
+
+		memcpy(buf + safe_strlen(buf) - strlen(SUFFIX), KEY, sizeof (KEY));
+		if (!stat(buf, &st)) {
+			entries[n].size += (uint64_t)st.st_size;
+		}
+		memcpy(entries[n].name, dirent->d_name, len + 1);
+		total += entries[n++].size;
+	}
+	closedir(dir);
+	qsort(entries, n, sizeof (entries[0]), entry_cmp);
+	for (i=0; (i < n) && (total > cache->budget); ++i) {
+		if (!strcmp(entries[i].name, keep)) {
+			continue;
+		}
+		safe_sprintf(buf,
+			     sizeof (buf),
+			     "%s/%s",
+			     cache->dirname,
+			     entries[i].name);
+		file_delete(buf);
+		memcpy(buf + safe_strlen(buf) - strlen(SUFFIX), KEY, sizeof (KEY));
+		file_delete(buf);
+		total -= entries[i].size;
+	}
+	FREE(entries);
+}
+
+struct cache *
+cache_open(const char *dirname, uint64_t budget)
+{
+	struct cache *cache;
+	size_t n;
+
+	assert( safe_strlen(dirname) );
+
+	if (mkdir(dirname, 0755) && (EEXIST != errno)) {
+		TRACE("mkdir()");
+		return NULL;
+	}
+	if (!(cache = malloc(sizeof (struct cache)))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(cache, 0, sizeof (struct cache));
+	n = safe_strlen(dirname) + 1;
+	if (!(cache->dirname = malloc(n))) {
+		cache_close(cache);
+		TRACE("out of memory");
+		return NULL;
+	}
+	memcpy(cache->dirname, dirname, n);
+	if (!(cache->target = target())) {
+		cache_close(cache);
+		TRACE(0);
+		return NULL;
+	}
+	cache->budget = budget;
+	return cache;
+}
+
+void
+cache_close(struct cache *cache)
+{
+	if (cache) {
+		FREE(cache->dirname);
+		FREE(cache->target);
+		memset(cache, 0, sizeof (struct cache));
+	}
+	FREE(cache);
+}
+
+const char *
+cache_compile(struct cache *cache,
+	      const char *source,
+	      enum jitc_level level,
+	      uint64_t *ns)
+{
+	char name[64], tmp[1024], pathname[1024];
+	uint64_t h[2], t;
+	struct stat st;
+	size_t len;
+	char *k;
+
+	assert( cache );
+	assert( safe_strlen(source) );
+
+	if (ns) {
+		(*ns) = 0;
+	}
+	if (!(k = key(cache, source, level))) {
+		TRACE(0);
+		return NULL;
+	}
+	len = safe_strlen(k);
+	h[0] = fnv1a(0xcbf29ce484222325, k, len);
+	h[1] = mix(0x6a09e667f3bcc908, k, len);
+	safe_sprintf(name,
+		     sizeof (name),
+		     "%016lx%016lx",
+		     (unsigned long)h[0],
+		     (unsigned long)h[1]);
+	safe_sprintf(cache->pathname,
+		     sizeof (cache->pathname),
+		     "%s/%s%s",
+		     cache->dirname,
+		     name,
+		     SUFFIX);
+	safe_sprintf(pathname,
+		     sizeof (pathname),
+		     "%s/%s%s",
+		     cache->dirname,
+		     name,
+		     KEY);
+
+	/* hit: same key, refresh recency */
+
+	if (!stat(cache->pathname, &st) && st.st_size && verify(pathname, k)) {
+		if (utimensat(AT_FDCWD, cache->pathname, NULL, 0)) {
+			/* ignore */
+		}
+		FREE(k);
+		return cache->pathname;
+	}
+
+	/* miss: compile aside, then publish atomically, the key first */
+
+	safe_sprintf(tmp,
+		     sizeof (tmp),
+		     "%s/%s.%d.tmp",
+		     cache->dirname,
+		     name,
+		     (int)getpid());
+	t = ns_time();
+	if (jitc_compile(source, tmp, level)) {
+		file_delete(tmp);
+		FREE(k);
+		TRACE(0);
+		return NULL;
+	}
+	if (ns) {
+		(*ns) = ns_time() - t;
+	}
+	if (store(pathname, k) || rename(tmp, cache->pathname)) {
+		file_delete(tmp);
+		FREE(k);
+		TRACE("rename()");
+		return NULL;
+	}
+	FREE(k);
+	strcat(name, SUFFIX);
+	evict(cache, name);
+	return cache->pathname;
+}
@@ -0,0 +1,63 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * cache.h
+ */
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include "system.h"
+#include "jitc.h"
+
+struct cache;
+
+/**
+ * Opens a content-addressed on-disk cache of dynamically loadable modules.
+ * Modules are keyed by their C source, the compiler flags and the host CPU
+ * (the flags include -march=native), and a hit is only taken once the
+ * stored key has been compared in full. The least recently used modules
+ * are evicted once the cache outgrows budget.
+ *
+ * dirname: the directory holding the cached modules (created if missing)
+ * budget : the maximum total size, in bytes, of the cached modules
+ *
+ * return: an opaque handle or NULL on error
+ */
+
+struct cache *cache_open(const char *dirname, uint64_t budget);
+
+/**
+ * Closes a previously opened cache handle. The cached modules are kept on
+ * disk for future runs.
+ *
+ * cache: an opaque handle previously obtained by calling cache_open()
+ *
+ * Note: cache may be NULL.
+ */
+
+void cache_close(struct cache *cache);
+
+/**
+ * Returns the file pathname of a dynamically loadable module compiled from
+ * the C program in source. On a cache hit the module is returned as is,
+ * otherwise it is compiled by calling jitc_compile() and inserted.
+ *
+ * cache : an opaque handle previously obtained by calling cache_open()
+ * source: the C program
+ * level : the optimization level, part of the key
+ * ns    : receives the time spent in gcc, 0 on a hit (may be NULL)
+ *
+ * return: the file pathname of the module, valid until the next call, or
+ *         NULL on error
+ */
+
+const char *cache_compile(struct cache *cache,
+			  const char *source,
+			  enum jitc_level level,
+			  uint64_t *ns);
+
+#endif /* _CACHE_H_ */
@@ -0,0 +1,510 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * codegen.c
+ */
+
+#include "intrinsic.h"
+#include "codegen.h"
+
+/**
+ * Formats val as a C expression that reads back as exactly val, so that
+ * folded constants are not rounded on their way through gcc.
+ */
+
+static const char *
+literal(double val, char *buf, size_t len)
+{
+	if (val != val) {
+		return "(0.0 / 0.0)";
+	}
+	if ((val - val) != 0.0) {
+		return (0.0 < val) ? "(1.0 / 0.0)" : "(-1.0 / 0.0)";
+	}
+	safe_sprintf(buf, len, "%.17g", val);
+	return buf;
+}
+
+/**
+ * Returns the name of the intrinsic computed by op, or NULL if op is not a
+ * call. Calls go to the inline definitions of intrinsic_source().
+ */
+
+static const char *
+call(enum parser_dag_op op)
+{
+	if (PARSER_DAG_EXP == op) {
+		return "exp_";
+	}
+	if (PARSER_DAG_LOG == op) {
+		return "log_";
+	}
+	if (PARSER_DAG_TANH == op) {
+		return "tanh_";
+	}
+	if (PARSER_DAG_SIGMOID == op) {
+		return "sigmoid_";
+	}
+	return NULL;
+}
+
+/**
+ * Emits the temporary of one node. Variables are read from x[var] by
+ * evaluate() and from the column pointer x<var> at row i by
+ * evaluate_batch().
+ */
+
+static void
+reflect(const struct parser_dag *dag, int batch, FILE *file)
+{
+	char buf[64];
+
+	if (dag) {
+		if (PARSER_DAG_VAR == dag->op) {
+			fprintf(file,
+				batch ? "double t%d = x%d[i];\n" :
+				"double t%d = x[%d];\n",
+				dag->id,
+				dag->var);
+		}
+		else if (PARSER_DAG_VAL == dag->op) {
+			fprintf(file,
+				"double t%d = %s;\n",
+				dag->id,
+				literal(dag->val, buf, sizeof (buf)));
+		}
+		else if (PARSER_DAG_NEG == dag->op) {
+			fprintf(file,
+				"double t%d = - t%d;\n",
+				dag->id,
+				dag->right->id);
+		}
+		else if (call(dag->op)) {
+			fprintf(file,
+				"double t%d = %s(t%d);\n",
+				dag->id,
+				call(dag->op),
+				dag->right->id);
+		}
+		else if (PARSER_DAG_MUL == dag->op) {
+			fprintf(file,
+				"double t%d = t%d * t%d;\n",
+				dag->id,
+				dag->left->id,
+				dag->right->id);
+		}
+		else if (PARSER_DAG_DIV == dag->op) {
+			fprintf(file,
+				"double t%d = t%d ? (t%d / t%d) : 0.0;\n",
+				dag->id,
+				dag->right->id,
+				dag->left->id,
+				dag->right->id);
+		}
+		else if (PARSER_DAG_ADD == dag->op) {
+			fprintf(file,
+				"double t%d = t%d + t%d;\n",
+				dag->id,
+				dag->left->id,
+				dag->right->id);
+		}
+		else if (PARSER_DAG_SUB == dag->op) {
+			fprintf(file,
+				"double t%d = t%d - t%d;\n",
+				dag->id,
+				dag->left->id,
+				dag->right->id);
+		}
+		else {
+			EXIT("software");
+		}
+	}
+}
+
+/**
+ * Emits the temporary of one node for evaluate_batchf_<w>(), a vector of w
+ * rows in single precision. Variables are read from x[var], the vectors
+ * of the current rows, and calls go to the definitions of
+ * intrinsic_source_lanes().
+ */
+
+static void
+lane(const struct parser_dag *dag, int w, FILE *file)
+{
+	char buf[64];
+
+	if (PARSER_DAG_VAR == dag->op) {
+		fprintf(file, "vf%d t%d = x[%d];\n", w, dag->id, dag->var);
+	}
+	else if (PARSER_DAG_VAL == dag->op) {
+		fprintf(file,
+			"vf%d t%d = z + (float)%s;\n",
+			w,
+			dag->id,
+			literal(dag->val, buf, sizeof (buf)));
+	}
+	else if (PARSER_DAG_NEG == dag->op) {
+		fprintf(file, "vf%d t%d = - t%d;\n", w, dag->id, dag->right->id);
+	}
+	else if (call(dag->op)) {
+		fprintf(file,
+			"vf%d t%d = %s%d(t%d);\n",
+			w,
+			dag->id,
+			call(dag->op),
+			w,
+			dag->right->id);
+	}
+	else if (PARSER_DAG_DIV == dag->op) {
+		fprintf(file,
+			"vf%d t%d = sel_%d(t%d != 0.0f, t%d / t%d, z);\n",
+			w,
+			dag->id,
+			w,
+			dag->right->id,
+			dag->left->id,
+			dag->right->id);
+	}
+	else if (PARSER_DAG_MUL == dag->op) {
+		fprintf(file,
+			"vf%d t%d = t%d * t%d;\n",
+			w,
+			dag->id,
+			dag->left->id,
+			dag->right->id);
+	}
+	else if (PARSER_DAG_ADD == dag->op) {
+		fprintf(file,
+			"vf%d t%d = t%d + t%d;\n",
+			w,
+			dag->id,
+			dag->left->id,
+			dag->right->id);
+	}
+	else if (PARSER_DAG_SUB == dag->op) {
+		fprintf(file,
+			"vf%d t%d = t%d - t%d;\n",
+			w,
+			dag->id,
+			dag->left->id,
+			dag->right->id);
+	}
+	else {
+		EXIT("software");
+	}
+}
+
+/**
+ * Emits the backward step of one node: its adjoint a<id>, complete since
+ * every parent has a larger id, is propagated to its children. The partial
+ * derivatives are those of the forward temporaries t<id>, so
+ * division by zero, whose result is 0.0, propagates nothing.
+ */
+
+static void
+adjoint(const struct parser_dag *dag, FILE *file)
+{
+	int l, r, t;
+
+	t = dag->id;
+	l = dag->left ? dag->left->id : 0;
+	r = dag->right ? dag->right->id : 0;
+	if (PARSER_DAG_VAR == dag->op) {
+		fprintf(file, "grad[%d] = a%d;\n", dag->var, t);
+	}
+	else if (PARSER_DAG_VAL == dag->op) {
+		/* nothing */
+	}
+	else if (PARSER_DAG_NEG == dag->op) {
+		fprintf(file, "a%d -= a%d;\n", r, t);
+	}
+	else if (PARSER_DAG_EXP == dag->op) {
+		fprintf(file, "a%d += a%d * t%d;\n", r, t, t);
+	}
+	else if (PARSER_DAG_LOG == dag->op) {
+		fprintf(file, "a%d += a%d / t%d;\n", r, t, r);
+	}
+	else if (PARSER_DAG_TANH == dag->op) {
+		fprintf(file, "a%d += a%d * (1.0 - t%d * t%d);\n", r, t, t, t);
+	}
+	else if (PARSER_DAG_SIGMOID == dag->op) {
+		fprintf(file, "a%d += a%d * t%d * (1.0 - t%d);\n", r, t, t, t);
+	}
+	else if (PARSER_DAG_MUL == dag->op) {
+		fprintf(file, "a%d += a%d * t%d;\n", l, t, r);
+		fprintf(file, "a%d += a%d * t%d;\n", r, t, l);
+	}
+	else if (PARSER_DAG_DIV == dag->op) {
+		fprintf(file, "d = t%d ? (a%d / t%d) : 0.0;\n", r, t, r);
+		fprintf(file, "a%d += d;\n", l);
+		fprintf(file, "a%d -= d * t%d;\n", r, t);
+	}
+	else if (PARSER_DAG_ADD == dag->op) {
+		fprintf(file, "a%d += a%d;\n", l, t);
+		fprintf(file, "a%d += a%d;\n", r, t);
+	}
+	else if (PARSER_DAG_SUB == dag->op) {
+		fprintf(file, "a%d += a%d;\n", l, t);
+		fprintf(file, "a%d -= a%d;\n", r, t);
+	}
+	else {
+		EXIT("software");
+	}
+}
+
+static void
+prologue(FILE *file)
+{
+	fprintf(file, "#include <stddef.h>\n");
+	fprintf(file, "typedef double (*sigmoid_t)(double);\n");
+	intrinsic_source(file);
+}
+
+/**
+ * Emits evaluate<suffix>() and evaluate_batch<suffix>() for dag.
+ */
+
+static int
+function(const struct parser_dag *dag, const char *suffix, FILE *file)
+{
+	const struct parser_dag **order;
+	int i, nvars;
+
+	/* shared nodes are emitted once, children before parents */
+
+	if (!(order = malloc((size_t)dag->id * sizeof (order[0])))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	parser_order(dag, order);
+	nvars = 0;
+	for (i=0; i<dag->id; ++i) {
+		if (PARSER_DAG_VAR == order[i]->op) {
+			nvars = MAX(nvars, order[i]->var + 1);
+		}
+	}
+
+	/* evaluate() */
+
+	fprintf(file,
+		"double evaluate%s(sigmoid_t sigmoid, const double *x) {\n",
+		suffix);
+	fprintf(file, "(void)x;\n");
+	for (i=0; i<dag->id; ++i) {
+		reflect(order[i], 0, file);
+	}
+	fprintf(file, "return sigmoid(t%d);\n}\n", dag->id);
+
+	/* evaluate_batch(): restrict columns and a branch-free body vectorize */
+
+	fprintf(file,
+		"void evaluate_batch%s(const double *const *cols, "
+		"size_t n, double *out) {\n",
+		suffix);
+	for (i=0; i<nvars; ++i) {
+		fprintf(file,
+			"const double *restrict x%d = cols[%d];\n",
+			i,
+			i);
+	}
+	fprintf(file, "double *restrict o = out;\n");
+	fprintf(file, "size_t i;\n");
+	fprintf(file, "(void)cols;\n");
+	fprintf(file, "#pragma GCC ivdep\n");
+	fprintf(file, "for (i = 0; i < n; ++i) {\n");
+	for (i=0; i<dag->id; ++i) {
+		reflect(order[i], 1, file);
+	}
+	fprintf(file, "o[i] = sigmoid_(t%d);\n}\n}\n", dag->id);
+	FREE(order);
+	return 0;
+}
+
+/**
+ * Emits evaluate_grad() for dag: the temporaries of evaluate(), then one
+ * reverse sweep over the same nodes accumulating adjoints.
+ */
+
+static int
+gradient(const struct parser_dag *dag, FILE *file)
+{
+	const struct parser_dag **order;
+	int i;
+
+	if (!(order = malloc((size_t)dag->id * sizeof (order[0])))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	parser_order(dag, order);
+	fprintf(file,
+		"double evaluate_grad(const double *x, double *grad) {\n");
+	fprintf(file, "double d;\n");
+	fprintf(file, "(void)x;\n");
+	fprintf(file, "(void)grad;\n");
+	fprintf(file, "(void)d;\n");
+	for (i=0; i<dag->id; ++i) {
+		reflect(order[i], 0, file);
+	}
+	for (i=1; i<dag->id; ++i) {
+		fprintf(file, "double a%d = 0.0;\n", i);
+	}
+	fprintf(file, "double a%d = 1.0;\n", dag->id);
+	for (i=dag->id-1; i>=0; --i) {
+		adjoint(order[i], file);
+	}
+	fprintf(file, "return t%d;\n}\n", dag->id);
+	FREE(order);
+	return 0;
+}
+
+/**
+ * Emits evaluate_batchf_<w>() for dag: lanes_<w>() computes w rows at once,
+ * the loop feeds it whole vectors and the last, partial one is padded with
+ * zeros. Wider vectors are compiled for the extension providing them, so
+ * every variant is in the module whatever the host; see
+ * codegen_float_symbol().
+ */
+
+static int
+vector(const struct parser_dag *dag, int w, const char *target, FILE *file)
+{
+	const struct parser_dag **order;
+	int i, nvars;
+
+	if (!(order = malloc((size_t)dag->id * sizeof (order[0])))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	parser_order(dag, order);
+	nvars = 0;
+	for (i=0; i<dag->id; ++i) {
+		if (PARSER_DAG_VAR == order[i]->op) {
+			nvars = MAX(nvars, order[i]->var + 1);
+		}
+	}
+	if (target) {
+		fprintf(file, "#if defined(__x86_64__)\n");
+		fprintf(file, "#pragma GCC push_options\n");
+		fprintf(file, "#pragma GCC target(\"%s\")\n", target);
+		fprintf(file, "#endif\n");
+	}
+	intrinsic_source_lanes(file, w);
+
+	/* lanes_<w>(): always inlined, so the temporaries stay in registers */
+
+	fprintf(file,
+		"static inline __attribute__((always_inline)) "
+		"vf%d lanes_%d(const vf%d *x) {\n",
+		w,
+		w,
+		w);
+	fprintf(file, "vf%d z = (vf%d){0};\n", w, w);
+	fprintf(file, "(void)x;\n");
+	fprintf(file, "(void)z;\n");
+	for (i=0; i<dag->id; ++i) {
+		lane(order[i], w, file);
+	}
+	fprintf(file, "return sigmoid_%d(t%d);\n}\n", w, dag->id);
+
+	/* evaluate_batchf_<w>() */
+
+	fprintf(file,
+		"void evaluate_batchf_%d(const float *const *cols, "
+		"size_t n, float *out) {\n",
+		w);
+	fprintf(file, "vf%d x[%d], o;\n", w, nvars + 1);
+	fprintf(file, "size_t i, k;\n");
+	fprintf(file, "int j;\n");
+	fprintf(file, "for (i = 0; i + %d <= n; i += %d) {\n", w, w);
+	for (i=0; i<nvars; ++i) {
+		fprintf(file,
+			"__builtin_memcpy(&x[%d], cols[%d] + i, sizeof (o));\n",
+			i,
+			i);
+	}
+	fprintf(file, "o = lanes_%d(x);\n", w);
+	fprintf(file, "__builtin_memcpy(out + i, &o, sizeof (o));\n}\n");
+	fprintf(file, "if (i < n) {\n");
+	fprintf(file, "k = (n - i) * sizeof (float);\n");
+	fprintf(file, "__builtin_memset(x, 0, sizeof (x));\n");
+	fprintf(file, "for (j = 0; j < %d; ++j) {\n", nvars);
+	fprintf(file, "__builtin_memcpy(&x[j], cols[j] + i, k);\n}\n");
+	fprintf(file, "o = lanes_%d(x);\n", w);
+	fprintf(file, "__builtin_memcpy(out + i, &o, k);\n}\n}\n");
+	if (target) {
+		fprintf(file, "#if defined(__x86_64__)\n");
+		fprintf(file, "#pragma GCC pop_options\n");
+		fprintf(file, "#endif\n");
+	}
+	FREE(order);
+	return 0;
+}
+
+int
+codegen(const struct parser_dag *dag, FILE *file)
+{
+	prologue(file);
+	if (function(dag, "", file)) {
+		TRACE(0);
+		return -1;
+	}
+	return 0;
+}
+
+int
+codegen_unit(const struct parser_dag * const *dags, int n, FILE *file)
+{
+	char suffix[32];
+	int i;
+
+	prologue(file);
+	for (i=0; i<n; ++i) {
+		safe_sprintf(suffix, sizeof (suffix), "_%d", i);
+		if (function(dags[i], suffix, file)) {
+			TRACE(0);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int
+codegen_grad(const struct parser_dag *dag, FILE *file)
+{
+	if (codegen(dag, file) || gradient(dag, file)) {
+		TRACE(0);
+		return -1;
+	}
+	return 0;
+}
+
+int
+codegen_float(const struct parser_dag *dag, FILE *file)
+{
+	if (codegen(dag, file) ||
+	    vector(dag, 4, NULL, file) ||
+	    vector(dag, 8, "avx2", file) ||
+	    vector(dag, 16, "avx512f", file)) {
+		TRACE(0);
+		return -1;
+	}
+	return 0;
+}
+
+const char *
+codegen_float_symbol(void)
+{
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return "evaluate_batchf_16";
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		return "evaluate_batchf_8";
+	}
+#endif
+	return "evaluate_batchf_4";
+}
@@ -0,0 +1,106 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * codegen.h
+ */
+
+#ifndef _CODEGEN_H_
+#define _CODEGEN_H_
+
+#include "system.h"
+#include "parser.h"
+
+/**
+ * The signatures shared by every backend. evaluate() applies the caller's
+ * sigmoid to the value of the expression, with x[i] the value of variable i
+ * (see parser_var()); x may be NULL if there are no variables.
+ *
+ * evaluate_batch() evaluates n rows at once: cols[i][row] is the value of
+ * variable i and out[row] receives the result under the logistic sigmoid.
+ *
+ * evaluate_grad() returns the value of the expression, without a sigmoid,
+ * and stores its partial derivative with respect to variable i in grad[i].
+ * Entries of variables that folding removed (e.g. x in x / 0) are not
+ * written, so grad should be cleared by the caller.
+ *
+ * evaluate_batchf_<w>() is evaluate_batch() in single precision, w rows per
+ * step, with w = 4, 8 or 16.
+ */
+
+typedef double (*sigmoid_t)(double);
+typedef double (*evaluate_t)(sigmoid_t, const double *x);
+typedef void (*evaluate_batch_t)(const double *const *cols,
+				 size_t n,
+				 double *out);
+typedef double (*evaluate_grad_t)(const double *x, double *grad);
+typedef void (*evaluate_batchf_t)(const float *const *cols,
+				  size_t n,
+				  float *out);
+
+/**
+ * Writes a C program defining evaluate() and evaluate_batch() for dag,
+ * suitable for jitc_compile(). The batch loop is written so that gcc can
+ * vectorize it for the host's widest SIMD extension. Intrinsics, and the
+ * sigmoid of evaluate_batch(), are inlined in the current precision, see
+ * intrinsic_precision().
+ *
+ * dag : the expression previously obtained by calling parser_dag()
+ * file: the stream receiving the C program
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int codegen(const struct parser_dag *dag, FILE *file);
+
+/**
+ * Writes a single C program for n expressions, with evaluate_<i>() and
+ * evaluate_batch_<i>() for dags[i], so they all share one gcc invocation.
+ *
+ * dags: the expressions previously obtained by calling parser_dag()
+ * n   : the number of expressions
+ * file: the stream receiving the C program
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int codegen_unit(const struct parser_dag * const *dags, int n, FILE *file);
+
+/**
+ * Same as codegen(), also defining evaluate_grad(): the value and every
+ * partial derivative in a single pass, by reverse-mode differentiation
+ * over the temporaries of evaluate().
+ *
+ * dag : the expression previously obtained by calling parser_dag()
+ * file: the stream receiving the C program
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int codegen_grad(const struct parser_dag *dag, FILE *file);
+
+/**
+ * Same as codegen(), also defining evaluate_batchf_4(), evaluate_batchf_8()
+ * and evaluate_batchf_16(): single precision, explicitly vectorized with
+ * GCC vector extensions of 4, 8 and 16 lanes, for SSE2, AVX2 and AVX-512F
+ * respectively on x86-64. Intrinsics are single-precision approximations,
+ * see intrinsic_source_lanes(), whatever the current precision.
+ *
+ * dag : the expression previously obtained by calling parser_dag()
+ * file: the stream receiving the C program
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int codegen_float(const struct parser_dag *dag, FILE *file);
+
+/**
+ * Returns the name of the widest evaluate_batchf_<w>() the host CPU can
+ * run, found by runtime feature detection, for jitc_lookup().
+ */
+
+const char *codegen_float_symbol(void);
+
+#endif /* _CODEGEN_H_ */
@@ -0,0 +1,336 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * intrinsic.c
+ */
+
+#include <math.h>
+#include "intrinsic.h"
+
+/**
+ * The fast approximations, defined once: FAST is both compiled here, for
+ * folding and for the interpreted and x64 backends, and emitted verbatim by
+ * intrinsic_source(), so generated code computes the same bits. Being a
+ * macro argument when stringified, its text must not contain a comma
+ * outside of parentheses.
+ *
+ * exp : x = k ln2 + r, |r| <= ln2/2, with k rounded by the 1.5 * 2^52
+ *       trick and 2^k built in the exponent bits, and a degree 11 Taylor
+ *       polynomial in r
+ * log : x = 2^e m, sqrt(1/2) <= m < sqrt(2), log(m) = 2 atanh(s) with
+ *       s = (m - 1) / (m + 1), |s| < 0.172, as an odd series in s
+ * tanh: 1 - 2 / (exp(2|x|) + 1), or its Taylor series when |x| < 1/16
+ */
+
+#define FAST							\
+static __inline__ double					\
+fast_exp(double x)						\
+{								\
+	unsigned long b;					\
+	double c;						\
+	double k;						\
+	double r;						\
+	double p;						\
+	double s;						\
+	c = (x < -708.0) ? -708.0 : x;				\
+	c = (c > 710.0) ? 710.0 : c;				\
+	k = c * 1.4426950408889634 + 6755399441055744.0;	\
+	__builtin_memcpy(&b, &k, sizeof (b));			\
+	k = k - 6755399441055744.0;				\
+	r = c - k * 6.93147180369123816490e-01;			\
+	r = r - k * 1.90821492927058770002e-10;			\
+	p = 2.5052108385441720e-08;				\
+	p = p * r + 2.7557319223985888e-07;			\
+	p = p * r + 2.7557319223985893e-06;			\
+	p = p * r + 2.4801587301587302e-05;			\
+	p = p * r + 1.9841269841269841e-04;			\
+	p = p * r + 1.3888888888888889e-03;			\
+	p = p * r + 8.3333333333333332e-03;			\
+	p = p * r + 4.1666666666666664e-02;			\
+	p = p * r + 1.6666666666666666e-01;			\
+	p = p * r + 0.5;					\
+	p = p * r + 1.0;					\
+	p = p * r + 1.0;					\
+	b = (b + 1022) << 52;					\
+	__builtin_memcpy(&s, &b, sizeof (s));			\
+	p = 2.0 * (p * s);					\
+	p = (x < -708.0) ? 0.0 : p;				\
+	return (x != x) ? x : p;				\
+}								\
+static __inline__ double					\
+fast_log(double x)						\
+{								\
+	unsigned long b;					\
+	double t;						\
+	double e;						\
+	double m;						\
+	double s;						\
+	double z;						\
+	double p;						\
+	t = (x < 2.2250738585072014e-308) ? (x * 18014398509481984.0) : x; \
+	e = (x < 2.2250738585072014e-308) ? -54.0 : 0.0;	\
+	__builtin_memcpy(&b, &t, sizeof (b));			\
+	b = (b >> 52) | 0x4330000000000000UL;			\
+	__builtin_memcpy(&m, &b, sizeof (m));			\
+	e = e + (m - 4503599627370496.0) - 1023.0;		\
+	__builtin_memcpy(&b, &t, sizeof (b));			\
+	b = (b & 0x000fffffffffffffUL) | 0x3ff0000000000000UL;	\
+	__builtin_memcpy(&m, &b, sizeof (m));			\
+	e = (m > 1.4142135623730951) ? (e + 1.0) : e;		\
+	m = (m > 1.4142135623730951) ? (m * 0.5) : m;		\
+	s = (m - 1.0) / (m + 1.0);				\
+	z = s * s;						\
+	p = 1.3333333333333333e-01;				\
+	p = p * z + 1.5384615384615385e-01;			\
+	p = p * z + 1.8181818181818182e-01;			\
+	p = p * z + 2.2222222222222221e-01;			\
+	p = p * z + 2.8571428571428570e-01;			\
+	p = p * z + 4.0000000000000002e-01;			\
+	p = p * z + 6.6666666666666663e-01;			\
+	p = p * z + 2.0;					\
+	p = e * 6.93147180369123816490e-01 +			\
+		(p * s + e * 1.90821492927058770002e-10);	\
+	p = (x == __builtin_inf()) ? x : p;			\
+	p = (x == 0.0) ? -__builtin_inf() : p;			\
+	p = (x < 0.0) ? __builtin_nan("") : p;			\
+	return (x != x) ? x : p;				\
+}								\
+static __inline__ double					\
+fast_tanh(double x)						\
+{								\
+	double a;						\
+	double y;						\
+	double z;						\
+	double p;						\
+	a = (x < 0.0) ? -x : x;					\
+	a = (a > 20.0) ? 20.0 : a;				\
+	y = 1.0 - 2.0 / (fast_exp(2.0 * a) + 1.0);		\
+	y = (x < 0.0) ? -y : y;					\
+	z = x * x;						\
+	p = 2.1869488536155203e-02;				\
+	p = p * z - 5.3968253968253971e-02;			\
+	p = p * z + 1.3333333333333333e-01;			\
+	p = p * z - 3.3333333333333331e-01;			\
+	p = p * z + 1.0;					\
+	return (a < 0.0625) ? (p * x) : y;			\
+}								\
+static __inline__ double					\
+fast_sigmoid(double x)						\
+{								\
+	return 1.0 / (1.0 + fast_exp(-x));			\
+}
+
+/**
+ * The single-precision approximations, on GCC vectors of W floats: the
+ * types vf<W> and vi<W> (its int lanes), sel_<W>() (a lane-wise m ? a : b)
+ * and exp_<W>(), log_<W>(), tanh_<W>() and sigmoid_<W>(). The methods are
+ * those of FAST, in float, with shorter polynomials; exp() flushes to 0.0
+ * below -86.5 and tanh() uses its series when |x| < 1/4. Only ever emitted,
+ * see intrinsic_source_lanes(), and the same rule about commas applies.
+ */
+
+#define LANES(W)							\
+typedef float vf##W __attribute__((vector_size(4 * W)));		\
+typedef int vi##W __attribute__((vector_size(4 * W)));			\
+static __inline__ vf##W							\
+sel_##W(vi##W m, vf##W a, vf##W b)					\
+{									\
+	return (vf##W)((m & (vi##W)a) | (~m & (vi##W)b));		\
+}									\
+static __inline__ vf##W							\
+exp_##W(vf##W x)							\
+{									\
+	vf##W z;							\
+	vf##W c;							\
+	vf##W k;							\
+	vf##W r;							\
+	vf##W p;							\
+	vf##W s;							\
+	vi##W b;							\
+	z = (vf##W){0};							\
+	c = sel_##W(x < -86.5f, z - 86.5f, x);				\
+	c = sel_##W(c > 89.0f, z + 89.0f, c);				\
+	k = c * 1.44269504f + 12582912.0f;				\
+	b = (vi##W)k - 0x4b400000;					\
+	k = k - 12582912.0f;						\
+	r = c - k * 0.693359375f;					\
+	r = r + k * 2.12194440e-4f;					\
+	p = z + 2.48015873e-05f;					\
+	p = p * r + 1.98412698e-04f;					\
+	p = p * r + 1.38888889e-03f;					\
+	p = p * r + 8.33333333e-03f;					\
+	p = p * r + 4.16666667e-02f;					\
+	p = p * r + 1.66666667e-01f;					\
+	p = p * r + 0.5f;						\
+	p = p * r + 1.0f;						\
+	p = p * r + 1.0f;						\
+	s = (vf##W)((b + 126) << 23);					\
+	p = 2.0f * (p * s);						\
+	p = sel_##W(x < -86.5f, z, p);					\
+	return sel_##W(x != x, x, p);					\
+}									\
+static __inline__ vf##W							\
+log_##W(vf##W x)							\
+{									\
+	vf##W z;							\
+	vf##W t;							\
+	vf##W e;							\
+	vf##W m;							\
+	vf##W s;							\
+	vf##W q;							\
+	vf##W p;							\
+	vi##W b;							\
+	vi##W d;							\
+	z = (vf##W){0};							\
+	d = x < 1.17549435e-38f;					\
+	t = sel_##W(d, x * 16777216.0f, x);				\
+	e = sel_##W(d, z - 24.0f, z);					\
+	b = (vi##W)t;							\
+	e = e + __builtin_convertvector((b >> 23) - 127, vf##W);	\
+	m = (vf##W)((b & 0x007fffff) | 0x3f800000);			\
+	d = m > 1.41421356f;						\
+	e = sel_##W(d, e + 1.0f, e);					\
+	m = sel_##W(d, m * 0.5f, m);					\
+	s = (m - 1.0f) / (m + 1.0f);					\
+	q = s * s;							\
+	p = z + 2.22222222e-01f;					\
+	p = p * q + 2.85714286e-01f;					\
+	p = p * q + 4.00000000e-01f;					\
+	p = p * q + 6.66666667e-01f;					\
+	p = p * q + 2.0f;						\
+	p = e * 0.693359375f + (p * s - e * 2.12194440e-4f);		\
+	p = sel_##W(x == __builtin_inff(), x, p);			\
+	p = sel_##W(x == 0.0f, z - __builtin_inff(), p);		\
+	p = sel_##W(x < 0.0f, z + __builtin_nanf(""), p);		\
+	return sel_##W(x != x, x, p);					\
+}									\
+static __inline__ vf##W							\
+tanh_##W(vf##W x)							\
+{									\
+	vf##W z;							\
+	vf##W a;							\
+	vf##W y;							\
+	vf##W q;							\
+	vf##W p;							\
+	z = (vf##W){0};							\
+	a = (vf##W)((vi##W)x & 0x7fffffff);				\
+	a = sel_##W(a > 9.0f, z + 9.0f, a);				\
+	y = 1.0f - 2.0f / (exp_##W(2.0f * a) + 1.0f);			\
+	y = sel_##W(x < 0.0f, -y, y);					\
+	q = x * x;							\
+	p = z + 2.18694885e-02f;					\
+	p = p * q - 5.39682540e-02f;					\
+	p = p * q + 1.33333333e-01f;					\
+	p = p * q - 3.33333333e-01f;					\
+	p = p * q + 1.0f;						\
+	return sel_##W(a < 0.25f, p * x, y);				\
+}									\
+static __inline__ vf##W							\
+sigmoid_##W(vf##W x)							\
+{									\
+	return 1.0f / (1.0f + exp_##W(-x));				\
+}
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+FAST
+
+static enum intrinsic_precision current = INTRINSIC_EXACT;
+
+void
+intrinsic_precision(enum intrinsic_precision precision)
+{
+	current = precision;
+}
+
+double
+intrinsic_exp(double x)
+{
+	return (INTRINSIC_FAST == current) ? fast_exp(x) : exp(x);
+}
+
+double
+intrinsic_log(double x)
+{
+	return (INTRINSIC_FAST == current) ? fast_log(x) : log(x);
+}
+
+double
+intrinsic_tanh(double x)
+{
+	return (INTRINSIC_FAST == current) ? fast_tanh(x) : tanh(x);
+}
+
+double
+intrinsic_sigmoid(double x)
+{
+	return (INTRINSIC_FAST == current) ?
+		fast_sigmoid(x) :
+		(1.0 / (1.0 + exp(-x)));
+}
+
+void
+intrinsic_source(FILE *file)
+{
+	const char *NAMES[] = { "exp", "log", "tanh", "sigmoid" };
+	int i;
+
+	if (INTRINSIC_FAST == current) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverlength-strings"
+		fprintf(file, "%s\n", XSTR(FAST));
+#pragma GCC diagnostic pop
+		for (i=0; i<(int)ARRAY_SIZE(NAMES); ++i) {
+			fprintf(file,
+				"static inline double %s_(double x) "
+				"{ return fast_%s(x); }\n",
+				NAMES[i],
+				NAMES[i]);
+		}
+		return;
+	}
+
+	/* libmvec has exp() and log() since glibc 2.22, tanh() since 2.35 */
+
+	fprintf(file, "#include <features.h>\n");
+	fprintf(file, "__attribute__((simd(\"notinbranch\")))\n");
+	fprintf(file, "double exp(double);\n");
+	fprintf(file, "__attribute__((simd(\"notinbranch\")))\n");
+	fprintf(file, "double log(double);\n");
+	fprintf(file, "#if __GLIBC_PREREQ(2, 35)\n");
+	fprintf(file, "__attribute__((simd(\"notinbranch\")))\n");
+	fprintf(file, "#endif\n");
+	fprintf(file, "double tanh(double);\n");
+	for (i=0; i<(int)ARRAY_SIZE(NAMES) - 1; ++i) {
+		fprintf(file,
+			"static inline double %s_(double x) { return %s(x); }\n",
+			NAMES[i],
+			NAMES[i]);
+	}
+	fprintf(file, "static inline double sigmoid_(double x) {\n");
+	fprintf(file, "return 1.0 / (1.0 + exp(-x));\n}\n");
+}
+
+void
+intrinsic_source_lanes(FILE *file, int lanes)
+{
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverlength-strings"
+	if (4 == lanes) {
+		fprintf(file, "%s\n", XSTR(LANES(4)));
+	}
+	else if (8 == lanes) {
+		fprintf(file, "%s\n", XSTR(LANES(8)));
+	}
+	else if (16 == lanes) {
+		fprintf(file, "%s\n", XSTR(LANES(16)));
+	}
+	else {
+		EXIT("software");
+	}
+#pragma GCC diagnostic pop
+}
@@ -0,0 +1,68 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * intrinsic.h
+ */
+
+#ifndef _INTRINSIC_H_
+#define _INTRINSIC_H_
+
+#include "system.h"
+
+/**
+ * The intrinsic functions of the expression language: exp(), log(), tanh()
+ * and sigmoid(). Every backend computes them the same way, in one of two
+ * precisions:
+ *
+ *   INTRINSIC_EXACT: libm (the SIMD variants of libmvec where available)
+ *   INTRINSIC_FAST : branch-free polynomial approximations, relative error
+ *                    below 1e-12, written so that gcc can inline and
+ *                    vectorize them; exp() flushes to 0.0 below -708
+ */
+
+enum intrinsic_precision {
+	INTRINSIC_EXACT,
+	INTRINSIC_FAST
+};
+
+/**
+ * Selects the precision of every intrinsic from now on, process wide. It
+ * must be set before parsing since constants are folded in it.
+ */
+
+void intrinsic_precision(enum intrinsic_precision precision);
+
+double intrinsic_exp(double x);
+
+double intrinsic_log(double x);
+
+double intrinsic_tanh(double x);
+
+double intrinsic_sigmoid(double x);
+
+/**
+ * Writes C definitions of exp_(), log_(), tanh_() and sigmoid_(), computing
+ * the intrinsics in the current precision, for generated programs to call
+ * inline.
+ *
+ * file: the stream receiving the C definitions
+ */
+
+void intrinsic_source(FILE *file);
+
+/**
+ * Writes C definitions of the types vf<lanes> and vi<lanes>, GCC vectors of
+ * lanes floats and ints, and of exp_<lanes>(), log_<lanes>(), tanh_<lanes>()
+ * and sigmoid_<lanes>() on them. These are single-precision approximations,
+ * relative error below 1e-6, whatever the current precision.
+ *
+ * file : the stream receiving the C definitions
+ * lanes: 4, 8 or 16
+ */
+
+void intrinsic_source_lanes(FILE *file, int lanes);
+
+#endif /* _INTRINSIC_H_ */
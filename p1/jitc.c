@@ -7,10 +7,18 @@
  * jitc.c
  */
 
+#define _GNU_SOURCE
+
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <dlfcn.h>
+#include <ftw.h>
 #include "system.h"
 #include "jitc.h"
 
@@ -20,51 +28,506 @@ struct jitc
     void * handle;
 };
 
+/* Flags passed to gcc, in the order they appear on its command line */
+static const char * const FLAGS[] = {
+    "-shared", "-fPIC",
+    /* let loops over columns vectorize for the host, including exp() */
+    "-march=native", "-fno-math-errno"
+};
+
+/* The optimization flag, indexed by enum jitc_level */
+static const char * const LEVELS[] = { "-O0", "-O1", "-O2", "-O3" };
+
+/* Libraries linked after the input (libmvec provides vector exp()) */
+static const char * const LIBS[] = { "-lmvec", "-lm" };
+
+#define GCC "/usr/bin/gcc"
+
+/* Upper bound on concurrent gcc processes, however many cores there are */
+#define POOL_MAX 64
+
+/* One pending or finished compilation, see jitc_compile_async() */
+struct jitc_job
+{
+    struct jitc_job *next; /* queue link while pending */
+    char *source;
+    char *output;
+    enum jitc_level level;
+    char *profile; /* PGO profile directory, or NULL */
+    int use; /* nonzero: build with the profile, otherwise instrument */
+    int status; /* 0 on success, valid once done is set */
+    int done;
+};
+
+/*
+ * The compiler pool: worker threads, started on demand up to one per core,
+ * each take a job off the queue and drive one gcc process to completion.
+ */
+static struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t work; /* a job was queued */
+    pthread_cond_t done; /* a job finished */
+    struct jitc_job *head, *tail;
+    int queued;
+    int workers;
+    int idle;
+    int max;
+} pool = {
+    PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    NULL, NULL, 0, 0, 0, 0
+};
+
+static char flags[JITC_END][256];
+static pthread_once_t flags_once = PTHREAD_ONCE_INIT;
+
+static void init_flags(void){
+    size_t i, n;
+    int level;
+
+    for (level = 0; level < JITC_END; ++level) {
+        for (i = 0, n = 0; i < ARRAY_SIZE(FLAGS); ++i) {
+            safe_sprintf(flags[level] + n, sizeof(flags[level]) - n, "%s ", FLAGS[i]);
+            n = safe_strlen(flags[level]);
+        }
+        safe_sprintf(flags[level] + n, sizeof(flags[level]) - n, "%s", LEVELS[level]);
+        n = safe_strlen(flags[level]);
+        for (i = 0; i < ARRAY_SIZE(LIBS); ++i) {
+            safe_sprintf(flags[level] + n, sizeof(flags[level]) - n, " %s", LIBS[i]);
+            n = safe_strlen(flags[level]);
+        }
+    }
+}
+
 /**
- * Compiles a C program into a dynamically loadable module.
- *
- * input : the file pathname of the C program
- * output: the file pathname of the dynamically loadable module
+ * Returns the compiler flags passed to gcc by jitc_compile() at level,
+ * separated by spaces.
+ */
+const char *jitc_flags(enum jitc_level level){
+    assert(level < JITC_END);
+    pthread_once(&flags_once, init_flags);
+    return flags[level];
+}
+
+/**
+ * Writes len bytes of buf to the pipe fd. SIGPIPE is blocked for the
+ * calling thread meanwhile, so a compiler that dies early shows up as EPIPE
+ * (and a failed exit status) instead of killing the process.
+ */
+static int feed(int fd, const char *buf, size_t len){
+    struct timespec zero;
+    sigset_t set, old;
+    ssize_t n;
+    int e;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+    e = 0;
+    while (len) {
+        if ((n = write(fd, buf, len)) < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            e = -1;
+            break;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    if (e && (EPIPE == errno) && !sigismember(&old, SIGPIPE)) {
+        /* discard the SIGPIPE pending on this thread */
+        zero.tv_sec = 0;
+        zero.tv_nsec = 0;
+        sigtimedwait(&set, NULL, &zero);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return e;
+}
+
+/**
+ * Runs gcc on source, writing the module to output. gcc is started with
+ * posix_spawn(), which does not copy the (possibly large) address space of
+ * the caller, and its stdin is the read end of a pipe. Both ends are
+ * close-on-exec, so concurrent compilers never inherit each other's pipes
+ * (which would keep them from ever seeing end of input).
  *
  * return: 0 on success, otherwise error
  */
-int jitc_compile(const char *input, const char *output){
+static int build(const char *source,
+                 const char *output,
+                 enum jitc_level level,
+                 const char *profile,
+                 int use){
+    posix_spawn_file_actions_t actions;
+    char* spawn_args[1 + ARRAY_SIZE(FLAGS) + 9 + ARRAY_SIZE(LIBS) + 1];
+    char flag[256];
+    int child_status, fd[2], e;
+    size_t i, n;
     pid_t pid;
-    int child_status;
-    char* execv_args[8];
-
-    if ((pid = fork()) < 0){
-        TRACE("Error while creating fork");
-    } else if (0 == pid) {
-        /* Part Executed By Child */
-        /* Arguments for execv() */
-        execv_args[0] = "/usr/bin/gcc";
-        execv_args[1] = "-shared"; 
-        execv_args[2] = "-fPIC";
-        execv_args[3] = "-O3";
-        execv_args[4] = "-o";
-        execv_args[5] = (char*) output;
-        execv_args[6] = (char*) input;
-        execv_args[7] = NULL;
-    
-        execv("/usr/bin/gcc", execv_args);
-    } else {
-        /* Part Executed By Parent */
-        if (waitpid(pid, &child_status, 0) == -1)
-        {
+
+    /* Arguments for posix_spawn() */
+    n = 0;
+    spawn_args[n++] = GCC;
+    for (i = 0; i < ARRAY_SIZE(FLAGS); ++i) {
+        spawn_args[n++] = (char*) FLAGS[i];
+    }
+    spawn_args[n++] = (char*) LEVELS[level];
+    if (profile) {
+        safe_sprintf(flag,
+                     sizeof(flag),
+                     "-fprofile-%s=%s",
+                     use ? "use" : "generate",
+                     profile);
+        spawn_args[n++] = flag;
+        if (use) {
+            /* code the training never reached is optimized as usual */
+            spawn_args[n++] = "-fprofile-partial-training";
+        }
+    }
+    spawn_args[n++] = "-pipe";
+    spawn_args[n++] = "-o";
+    spawn_args[n++] = (char*) output;
+    spawn_args[n++] = "-x";
+    spawn_args[n++] = "c";
+    spawn_args[n++] = "-";
+    for (i = 0; i < ARRAY_SIZE(LIBS); ++i) {
+        spawn_args[n++] = (char*) LIBS[i];
+    }
+    spawn_args[n] = NULL;
+
+    if (pipe2(fd, O_CLOEXEC)) {
+        TRACE("pipe2()");
+        return 1;
+    }
+    if (posix_spawn_file_actions_init(&actions)) {
+        close(fd[0]);
+        close(fd[1]);
+        TRACE("posix_spawn_file_actions_init()");
+        return 1;
+    }
+    /* The source arrives on stdin (dup2() clears close-on-exec) */
+    e = posix_spawn_file_actions_adddup2(&actions, fd[0], 0);
+    if (!e) {
+        e = posix_spawn(&pid, GCC, &actions, NULL, spawn_args, environ);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    close(fd[0]);
+    if (e) {
+        close(fd[1]);
+        TRACE("posix_spawn()");
+        return 1;
+    }
+    e = feed(fd[1], source, safe_strlen(source));
+    close(fd[1]);
+    while (waitpid(pid, &child_status, 0) == -1)
+    {
+        if (EINTR != errno) {
             TRACE("CHILD ERROR");
             return 1;
         }
-        else
-        {
-            if(WIFEXITED(child_status)){
-                printf("Process exited with Exit Status = %d\n",WEXITSTATUS(child_status));
-            }
+    }
+    /* Do not report (and let callers cache) a failed build */
+    if (e || !WIFEXITED(child_status) || WEXITSTATUS(child_status)) {
+        TRACE("gcc failed");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Body of a pool thread: builds queued jobs, one at a time, forever.
+ */
+static void *worker(void *arg){
+    struct jitc_job *job;
+    int status;
+
+    (void)arg;
+    pthread_mutex_lock(&pool.mutex);
+    for (;;) {
+        while (!pool.head) {
+            ++pool.idle;
+            pthread_cond_wait(&pool.work, &pool.mutex);
+            --pool.idle;
         }
+        job = pool.head;
+        if (!(pool.head = job->next)) {
+            pool.tail = NULL;
+        }
+        --pool.queued;
+        pthread_mutex_unlock(&pool.mutex);
+
+        status = build(job->source,
+                       job->output,
+                       job->level,
+                       job->profile,
+                       job->use);
+
+        pthread_mutex_lock(&pool.mutex);
+        job->status = status;
+        __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&pool.done);
+    }
+    return NULL;
+}
+
+/**
+ * Appends job to the queue, starting another pool thread if every existing
+ * one is busy and the pool is below its bound. Called with the pool locked.
+ *
+ * return: 0 on success, otherwise error (no thread will ever run job)
+ */
+static int enqueue(struct jitc_job *job){
+    pthread_attr_t attr;
+    pthread_t thread;
+    long cores;
+    int e;
+
+    if (!pool.max) {
+        cores = sysconf(_SC_NPROCESSORS_ONLN);
+        pool.max = (int) ((0 < cores) ? MIN(cores, POOL_MAX) : 1);
     }
+    if (pool.tail) {
+        pool.tail->next = job;
+    } else {
+        pool.head = job;
+    }
+    pool.tail = job;
+    ++pool.queued;
+    if ((pool.queued > pool.idle) && (pool.workers < pool.max)) {
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        e = pthread_create(&thread, &attr, worker, NULL);
+        pthread_attr_destroy(&attr);
+        if (!e) {
+            ++pool.workers;
+        } else if (!pool.workers) {
+            /* Nobody to run it: take the job back */
+            pool.head = pool.tail = NULL;
+            pool.queued = 0;
+            TRACE("pthread_create()");
+            return 1;
+        }
+    }
+    pthread_cond_signal(&pool.work);
     return 0;
 }
 
+static struct jitc_job *submit(const char *source,
+                               const char *output,
+                               enum jitc_level level,
+                               const char *profile,
+                               int use);
+
+/**
+ * Starts compiling a C program into a dynamically loadable module on the
+ * compiler pool and returns without waiting for gcc.
+ *
+ * source: the C program (copied)
+ * output: the file pathname of the dynamically loadable module
+ * level : the optimization level
+ *
+ * return: a job handle for jitc_poll() and jitc_wait(), or NULL on error
+ */
+struct jitc_job *jitc_compile_async(const char *source,
+                                    const char *output,
+                                    enum jitc_level level){
+    return submit(source, output, level, NULL, 0);
+}
+
+/**
+ * Queues a job for the compiler pool, see jitc_compile_async(). If profile
+ * is not NULL, the module is instrumented to write a profile there or, if
+ * use is nonzero, built with the profile found there.
+ */
+static struct jitc_job *submit(const char *source,
+                               const char *output,
+                               enum jitc_level level,
+                               const char *profile,
+                               int use){
+    struct jitc_job *job;
+    size_t n, m, k;
+
+    assert(level < JITC_END);
+
+    n = safe_strlen(source) + 1;
+    m = safe_strlen(output) + 1;
+    k = profile ? (safe_strlen(profile) + 1) : 0;
+    if (!(job = malloc(sizeof(struct jitc_job) + n + m + k))) {
+        TRACE("Memory Full");
+        return NULL;
+    }
+    memset(job, 0, sizeof(struct jitc_job));
+    job->source = (char*) (job + 1);
+    job->output = job->source + n;
+    memcpy(job->source, source, n);
+    memcpy(job->output, output, m);
+    if (profile) {
+        job->profile = job->output + m;
+        memcpy(job->profile, profile, k);
+    }
+    job->use = use;
+    job->level = level;
+
+    pthread_mutex_lock(&pool.mutex);
+    if (enqueue(job)) {
+        pthread_mutex_unlock(&pool.mutex);
+        FREE(job);
+        return NULL;
+    }
+    pthread_mutex_unlock(&pool.mutex);
+    return job;
+}
+
+/**
+ * Checks, without blocking, whether job has finished.
+ *
+ * job: a handle previously obtained by calling jitc_compile_async()
+ *
+ * return: non-zero once jitc_wait() would return immediately
+ */
+int jitc_poll(const struct jitc_job *job){
+    return __atomic_load_n(&job->done, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Blocks until job has finished, then releases it.
+ *
+ * job: a handle previously obtained by calling jitc_compile_async()
+ *
+ * return: 0 on success, otherwise error
+ */
+int jitc_wait(struct jitc_job *job){
+    int status;
+
+    if (!jitc_poll(job)) {
+        pthread_mutex_lock(&pool.mutex);
+        while (!job->done) {
+            pthread_cond_wait(&pool.done, &pool.mutex);
+        }
+        pthread_mutex_unlock(&pool.mutex);
+    }
+    status = job->status;
+    FREE(job);
+    return status;
+}
+
+/**
+ * Compiles a C program into a dynamically loadable module.
+ *
+ * source: the C program, fed to gcc over a pipe
+ * output: the file pathname of the dynamically loadable module
+ * level : the optimization level
+ *
+ * return: 0 on success, otherwise error
+ */
+int jitc_compile(const char *source, const char *output, enum jitc_level level){
+    struct jitc_job *job;
+
+    if (!(job = jitc_compile_async(source, output, level))) {
+        TRACE(0);
+        return 1;
+    }
+    return jitc_wait(job);
+}
+
+/**
+ * nftw() callback removing every entry of a profile directory, depth first.
+ */
+static int unlink_one(const char *path, const struct stat *st, int flag,
+                      struct FTW *ftw){
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+/**
+ * Compiles a C program into a dynamically loadable module, guided by the
+ * profile of a training run. gcc names the profile after output, so both
+ * builds write output: the instrumented module is loaded, trained and
+ * unloaded (which writes the profile) before the final build replaces it.
+ * The profile lives in a private temporary directory, removed afterwards.
+ *
+ * source: the C program, fed to gcc over a pipe
+ * output: the file pathname of the dynamically loadable module
+ * level : the optimization level
+ * train : runs the instrumented module on representative input
+ * arg   : passed to train
+ *
+ * return: 0 on success, otherwise error
+ */
+int jitc_compile_pgo(const char *source,
+                     const char *output,
+                     enum jitc_level level,
+                     jitc_train_t train,
+                     void *arg){
+    const char *tmp;
+    char dir[192]; /* fits -fprofile-generate=dir, see build() */
+    struct jitc_job *job;
+    struct jitc *jitc;
+    int e;
+
+    /* the profiles go to TMPDIR, if set, as for every temporary file */
+    if (!(tmp = getenv("TMPDIR")) || !*tmp) {
+        tmp = "/tmp";
+    }
+    if (sizeof(dir) <= safe_strlen(tmp) + sizeof("/jitc-pgo-XXXXXX") - 1) {
+        TRACE("TMPDIR too long");
+        return 1;
+    }
+    safe_sprintf(dir, sizeof(dir), "%s/jitc-pgo-XXXXXX", tmp);
+    if (!mkdtemp(dir)) {
+        TRACE("mkdtemp()");
+        return 1;
+    }
+    e = 1;
+    if ((job = submit(source, output, level, dir, 0)) && !jitc_wait(job)) {
+        if ((jitc = jitc_open(output))) {
+            e = train(jitc, arg);
+            jitc_close(jitc);
+        }
+    }
+    if (!e) {
+        e = 1;
+        if ((job = submit(source, output, level, dir, 1))) {
+            e = jitc_wait(job);
+        }
+    }
+    if (nftw(dir, unlink_one, 8, FTW_DEPTH | FTW_PHYS)) {
+        /* ignore */
+    }
+    if (e) {
+        TRACE(0);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Creates an anonymous in-memory file to receive a module, so that neither
+ * compiling nor loading touches the filesystem.
+ *
+ * pathname: receives the /proc/self/fd/N pathname of the file, to be passed
+ *           to jitc_compile() and jitc_open()
+ * len     : the size of pathname
+ *
+ * return: the file descriptor, or -1 on error
+ */
+int jitc_memfd(char *pathname, size_t len){
+    int fd;
+
+    /* not close-on-exec: gcc (and ld) write through the same pathname */
+    if ((fd = memfd_create("jitc", 0)) < 0) {
+        TRACE("memfd_create()");
+        return -1;
+    }
+    safe_sprintf(pathname, len, "/proc/self/fd/%d", fd);
+    return fd;
+}
+
 /**
  * Loads a dynamically loadable module into the calling process' memory for
  * execution.
@@ -85,6 +548,8 @@ struct jitc *jitc_open(const char *pathname){
     if (jitc->handle == NULL)
     {
         TRACE("Handle Not Found or Null");
+        FREE(jitc);
+        return NULL;
     }
     return jitc;
 }
@@ -10,18 +10,133 @@
 #ifndef _JITC_H_
 #define _JITC_H_
 
+#include <stddef.h>
+
 struct jitc;
+struct jitc_job;
+
+/**
+ * gcc optimization levels, from cheapest to compile to fastest to run.
+ */
+
+enum jitc_level {
+	JITC_O0,
+	JITC_O1,
+	JITC_O2,
+	JITC_O3,
+	JITC_END
+};
+
+/**
+ * Compiles a C program into a dynamically loadable module. The program is
+ * streamed to gcc over a pipe, so it never has to be written to disk.
+ *
+ * source: the C program
+ * output: the file pathname of the dynamically loadable module, e.g. one
+ *         obtained by calling jitc_memfd()
+ * level : the optimization level (see policy_level())
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int jitc_compile(const char *source,
+		 const char *output,
+		 enum jitc_level level);
+
+/**
+ * Starts compiling a C program into a dynamically loadable module and
+ * returns at once. Compilations run on a pool of at most one gcc process
+ * per core; the rest wait their turn in submission order. Every job must
+ * eventually be passed to jitc_wait().
+ *
+ * source: the C program (copied, so it may be released right away)
+ * output: the file pathname of the dynamically loadable module
+ * level : the optimization level
+ *
+ * return: a job handle or NULL on error
+ */
+
+struct jitc_job *jitc_compile_async(const char *source,
+				    const char *output,
+				    enum jitc_level level);
+
+/**
+ * Runs a module on representative input, see jitc_compile_pgo().
+ *
+ * jitc: the instrumented module, loaded
+ * arg : the caller's argument
+ *
+ * return: 0 on success, otherwise error
+ */
+
+typedef int (*jitc_train_t)(struct jitc *jitc, void *arg);
 
 /**
- * Compiles a C program into a dynamically loadable module.
+ * Same as jitc_compile(), with profile-guided optimization: the program is
+ * first built instrumented and handed to train, then rebuilt using the
+ * branch and call counts of that run. The profile is kept in a private
+ * temporary directory that is removed before returning. The cost is two
+ * gcc invocations plus the training run, so it pays off for long-lived
+ * modules only.
  *
- * input : the file pathname of the C program
+ * source: the C program
  * output: the file pathname of the dynamically loadable module
+ * level : the optimization level
+ * train : evaluates the instrumented module on representative input
+ * arg   : passed to train
  *
  * return: 0 on success, otherwise error
  */
 
-int jitc_compile(const char *input, const char *output);
+int jitc_compile_pgo(const char *source,
+		     const char *output,
+		     enum jitc_level level,
+		     jitc_train_t train,
+		     void *arg);
+
+/**
+ * Checks whether a compilation has finished, without blocking.
+ *
+ * job: a handle previously obtained by calling jitc_compile_async()
+ *
+ * return: non-zero if finished, in which case jitc_wait() does not block
+ */
+
+int jitc_poll(const struct jitc_job *job);
+
+/**
+ * Waits for a compilation to finish and releases job.
+ *
+ * job: a handle previously obtained by calling jitc_compile_async()
+ *
+ * return: 0 on success (output holds the module), otherwise error
+ */
+
+int jitc_wait(struct jitc_job *job);
+
+/**
+ * Creates an anonymous in-memory file to receive a module from
+ * jitc_compile() and load it with jitc_open(). The file (and its pathname)
+ * is private to the calling process, so concurrent compilations never
+ * collide. Close the file descriptor only after jitc_close(): the dynamic
+ * loader tells modules apart by pathname, and the number must not be
+ * reused while the module is loaded.
+ *
+ * pathname: receives the /proc/self/fd/N pathname of the file
+ * len     : the size of pathname
+ *
+ * return: the file descriptor, or -1 on error
+ */
+
+int jitc_memfd(char *pathname, size_t len);
+
+/**
+ * Returns the compiler flags and libraries jitc_compile() passes to gcc at
+ * level, separated by spaces. Callers caching compiled modules make these
+ * part of the key.
+ */
+
+const char *jitc_flags(enum jitc_level level);
 
 /**
  * Loads a dynamically loadable module into the calling process' memory for
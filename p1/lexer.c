@@ -9,89 +9,194 @@
 
 #include "lexer.h"
 
+/* character classes, operators map to their token */
+
+enum {
+	XX = LEXER_OP_, /* invalid */
+	AD = LEXER_OP_ADD,
+	SU = LEXER_OP_SUB,
+	MU = LEXER_OP_MUL,
+	DV = LEXER_OP_DIV,
+	OP = LEXER_OP_OPEN,
+	CL = LEXER_OP_CLOSE,
+	SP = 16, /* white space */
+	AL, /* [A-Za-z_] */
+	DI, /* [0-9] */
+	DT  /* '.' */
+};
+
+static const unsigned char CLASS[256] = {
+	XX, XX, XX, XX, XX, XX, XX, XX, /* 00 */
+	XX, SP, SP, SP, SP, SP, XX, XX, /* 08 */
+	XX, XX, XX, XX, XX, XX, XX, XX, /* 10 */
+	XX, XX, XX, XX, XX, XX, XX, XX, /* 18 */
+	SP, XX, XX, XX, XX, XX, XX, XX, /* 20 */
+	OP, CL, MU, AD, XX, SU, DT, DV, /* 28 */
+	DI, DI, DI, DI, DI, DI, DI, DI, /* 30 */
+	DI, DI, XX, XX, XX, XX, XX, XX, /* 38 */
+	XX, AL, AL, AL, AL, AL, AL, AL, /* 40 */
+	AL, AL, AL, AL, AL, AL, AL, AL, /* 48 */
+	AL, AL, AL, AL, AL, AL, AL, AL, /* 50 */
+	AL, AL, AL, XX, XX, XX, XX, AL, /* 58 */
+	XX, AL, AL, AL, AL, AL, AL, AL, /* 60 */
+	AL, AL, AL, AL, AL, AL, AL, AL, /* 68 */
+	AL, AL, AL, AL, AL, AL, AL, AL, /* 70 */
+	AL, AL, AL, XX, XX, XX, XX, XX, /* 78 */
+	XX, XX, XX, XX, XX, XX, XX, XX, /* 80 */
+	XX, XX, XX, XX, XX, XX, XX, XX, /* 88 */
+	XX, XX, XX, XX, XX, XX, XX, XX, /* 90 */
+	XX, XX, XX, XX, XX, XX, XX, XX, /* 98 */
+	XX, XX, XX, XX, XX, XX, XX, XX, /* a0 */
+	XX, XX, XX, XX, XX, XX, XX, XX, /* a8 */
+	XX, XX, XX, XX, XX, XX, XX, XX, /* b0 */
+	XX, XX, XX, XX, XX, XX, XX, XX, /* b8 */
+	XX, XX, XX, XX, XX, XX, XX, XX, /* c0 */
+	XX, XX, XX, XX, XX, XX, XX, XX, /* c8 */
+	XX, XX, XX, XX, XX, XX, XX, XX, /* d0 */
+	XX, XX, XX, XX, XX, XX, XX, XX, /* d8 */
+	XX, XX, XX, XX, XX, XX, XX, XX, /* e0 */
+	XX, XX, XX, XX, XX, XX, XX, XX, /* e8 */
+	XX, XX, XX, XX, XX, XX, XX, XX, /* f0 */
+	XX, XX, XX, XX, XX, XX, XX, XX  /* f8 */
+};
+
 struct lexer {
-	uint64_t size;
-	struct lexer_token *tokens;
+	const unsigned char *s; /* unconsumed input */
+	const unsigned char *end;
+	int done; /* the end of input token has been produced */
+	int error;
+	size_t i; /* next token in chunk */
+	size_t n; /* tokens in chunk */
+	struct lexer_token tokens[LEXER_CHUNK];
 };
 
-static struct lexer_token *
-mktoken(struct lexer *lexer, enum lexer_token_op op)
+/**
+ * Converts the number at s. Integers of up to 15 digits are exact in a
+ * double and converted inline; anything else goes through strtod(), which
+ * needs a terminated string, so the lexeme is copied out first.
+ */
+
+static const unsigned char *
+number(struct lexer_token *token,
+       const unsigned char *s,
+       const unsigned char *end)
 {
-	struct lexer_token *token, *tokens;
+	char buf[64], *e;
+	uint64_t v;
 	size_t n;
 
-	if (0 == (lexer->size % 100)) {
-		n = (lexer->size + 100) * sizeof (tokens[0]);
-		if (!(tokens = realloc(lexer->tokens, n))) {
-			TRACE("out of memory");
-			return NULL;
-		}
-		lexer->tokens = tokens;
+	v = 0;
+	for (n=0; (s + n < end) && (DI == CLASS[s[n]]) && (15 > n); ++n) {
+		v = 10 * v + (uint64_t)(s[n] - '0');
+	}
+	if (n && ((s + n == end) ||
+		  ((DI != CLASS[s[n]]) &&
+		   (DT != CLASS[s[n]]) &&
+		   (AL != CLASS[s[n]])))) {
+		token->val = (double)v;
+		return s + n;
+	}
+
+	n = MIN((size_t)(end - s), sizeof (buf) - 1);
+	memcpy(buf, s, n);
+	buf[n] = 0;
+	token->val = strtod(buf, &e);
+	if (buf == e) {
+		TRACE("lexer");
+		return NULL;
+	}
+	if (((size_t)(e - buf) == n) && (s + n < end)) {
+		TRACE("number too long");
+		return NULL;
 	}
-	token = &lexer->tokens[lexer->size++];
-	memset(token, 0, sizeof (struct lexer_token));
-	token->op = op;
-	return token;
+	return s + (e - buf);
 }
 
-static int
-tokenize(struct lexer *lexer, const char *s)
+/**
+ * Tokenizes the next chunk of input, stopping early at the end of input
+ * (after producing the LEXER_OP_ token) or on error.
+ */
+
+static void
+refill(struct lexer *lexer)
 {
-	const char * const OPERATORS = "+-*/()";
+	const unsigned char *s, *end;
 	struct lexer_token *token;
-	size_t i;
-	char *e;
-
-	while (*s) {
-		for (i=0; i<safe_strlen(OPERATORS); ++i) {
-			if (OPERATORS[i] == (*s)) {
-				if (!mktoken(lexer,
-					     LEXER_OP_ADD + i)) {
-					TRACE(0);
-					return -1;
-				}
-				break;
-			}
-		}
-		if (safe_strlen(OPERATORS) > i) {
+	size_t n;
+	int c;
+
+	s = lexer->s;
+	end = lexer->end;
+	lexer->i = 0;
+	lexer->n = 0;
+	while (!lexer->done && !lexer->error && (LEXER_CHUNK > lexer->n)) {
+		while ((s < end) && (SP == CLASS[*s])) {
 			++s;
 		}
-		else if (isspace(*s)) {
+		token = &lexer->tokens[lexer->n++];
+		token->val = 0.0;
+		token->name[0] = 0;
+		if (s == end) {
+			token->op = LEXER_OP_;
+			lexer->done = 1;
+			break;
+		}
+		c = CLASS[*s];
+		if ((AD <= c) && (CL >= c)) {
+			token->op = (enum lexer_token_op)c;
 			++s;
 		}
-		else {
-			if (!(token = mktoken(lexer, LEXER_OP_VAL))) {
-				TRACE(0);
-				return -1;
+		else if (AL == c) {
+			n = 1;
+			while ((s + n < end) &&
+			       ((AL == CLASS[s[n]]) || (DI == CLASS[s[n]]))) {
+				++n;
+			}
+			if (LEXER_NAME_MAX <= n) {
+				TRACE("variable name too long");
+				lexer->error = 1;
+				break;
 			}
-			token->val = strtod(s, &e);
-			if (s == e) {
-				TRACE("lexer");
-				return -1;
+			token->op = LEXER_OP_VAR;
+			memcpy(token->name, s, n);
+			token->name[n] = 0;
+			s += n;
+		}
+		else if ((DI == c) || (DT == c)) {
+			token->op = LEXER_OP_VAL;
+			if (!(s = number(token, s, end))) {
+				lexer->error = 1;
+				break;
 			}
-			s = e;
 		}
+		else {
+			TRACE("lexer");
+			lexer->error = 1;
+			break;
+		}
+	}
+	if (lexer->error) {
+		--lexer->n; /* drop the token in progress */
+	}
+	else {
+		lexer->s = s;
 	}
-	return 0;
 }
 
 struct lexer *
-lexer_open(const char *s)
+lexer_open(const char *s, size_t len)
 {
 	struct lexer *lexer;
 
-	assert( safe_strlen(s) );
+	assert( s || !len );
 
 	if (!(lexer = malloc(sizeof (struct lexer)))) {
 		TRACE("out of memory");
 		return NULL;
 	}
 	memset(lexer, 0, sizeof (struct lexer));
-	if (tokenize(lexer, s)) {
-		lexer_close(lexer);
-		TRACE(0);
-		return NULL;
-	}
+	lexer->s = (const unsigned char *)s;
+	lexer->end = lexer->s + len;
 	return lexer;
 }
 
@@ -99,25 +204,28 @@ void
 lexer_close(struct lexer *lexer)
 {
 	if (lexer) {
-		FREE(lexer->tokens);
 		memset(lexer, 0, sizeof (struct lexer));
 	}
 	FREE(lexer);
 }
 
-uint64_t
-lexer_size(const struct lexer *lexer)
-{
-	assert( lexer );
-
-	return lexer->size;
-}
-
 const struct lexer_token *
-lexer_lookup(const struct lexer *lexer, uint64_t i)
+lexer_next(struct lexer *lexer)
 {
 	assert( lexer );
-	assert( i < lexer->size );
 
-	return &lexer->tokens[i];
+	if (lexer->i == lexer->n) {
+		if (lexer->done) {
+			return &lexer->tokens[lexer->n - 1];
+		}
+		if (lexer->error) {
+			return NULL;
+		}
+		refill(lexer);
+		if (!lexer->n) {
+			TRACE(0);
+			return NULL;
+		}
+	}
+	return &lexer->tokens[lexer->i++];
 }
@@ -12,6 +12,9 @@
 
 #include "system.h"
 
+#define LEXER_NAME_MAX 32
+#define LEXER_CHUNK 256 /* tokens produced per refill */
+
 struct lexer_token {
 	enum lexer_token_op {
 		LEXER_OP_,
@@ -21,19 +24,36 @@ struct lexer_token {
 		LEXER_OP_MUL,  /* '*' */
 		LEXER_OP_DIV,  /* '/' */
 		LEXER_OP_OPEN, /* '(' */
-		LEXER_OP_CLOSE /* ')' */
+		LEXER_OP_CLOSE, /* ')' */
+		LEXER_OP_VAR    /* [A-Za-z_][A-Za-z0-9_]* */
 	} op;
 	double val;
+	char name[LEXER_NAME_MAX]; /* LEXER_OP_VAR */
 };
 
+/**
+ * The lexer is pull-based: tokens are produced LEXER_CHUNK at a time, as
+ * the parser asks for them, so token memory is bounded whatever the size of
+ * the input. Characters are classified with a single table lookup.
+ */
+
 struct lexer;
 
-struct lexer *lexer_open(const char *s);
+/**
+ * s  : the input, not necessarily terminated (e.g. a mapped file); it must
+ *      remain valid until lexer_close()
+ * len: the size of s, in bytes
+ */
+
+struct lexer *lexer_open(const char *s, size_t len);
 
 void lexer_close(struct lexer *lexer);
 
-uint64_t lexer_size(const struct lexer *lexer);
+/**
+ * Returns the next token, valid until the next call, or NULL on error. At
+ * the end of the input, and from then on, the token is LEXER_OP_.
+ */
 
-const struct lexer_token *lexer_lookup(const struct lexer *lexer, uint64_t i);
+const struct lexer_token *lexer_next(struct lexer *lexer);
 
 #endif /* _LEXER_H_ */
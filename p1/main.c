@@ -7,140 +7,884 @@
  * main.c
  */
 
+#define _GNU_SOURCE
+
+#include <unistd.h>
 #include "jitc.h"
+#include "batch.h"
+#include "cache.h"
+#include "codegen.h"
+#include "intrinsic.h"
 #include "parser.h"
+#include "policy.h"
+#include "registry.h"
+#include "stream.h"
+#include "tier.h"
+#include "unit.h"
+#include "vm.h"
+#include "x64.h"
 #include "system.h"
 #include<math.h>
 
 /* export LD_LIBRARY_PATH=. */
 
+#define CACHEDIR ".jitc"
+#define CACHESIZE (64 * 1024 * 1024)
+
 double sigmoid(double n){
 	return (1 / (1 + exp(-n)));
 }
 
-static void
-reflect(const struct parser_dag *dag, FILE *file)
+static int
+native(const struct parser_dag *dag, const double *x)
+{
+	struct x64 *x64;
+	evaluate_t fnc;
+
+	if (!(x64 = x64_open(dag)) ||
+	    !(fnc = (evaluate_t)x64_lookup(x64, "evaluate"))) {
+		x64_close(x64);
+		TRACE(0);
+		return -1;
+	}
+	printf("%f\n", fnc(&sigmoid, x));
+	x64_close(x64);
+	return 0;
+}
+
+static int
+interpreted(const struct parser_dag *dag, const double *x, uint64_t count)
+{
+	uint64_t i, t;
+	struct vm *vm;
+	double r;
+
+	if (!(vm = vm_open(dag))) {
+		TRACE(0);
+		return -1;
+	}
+	r = 0.0;
+	t = ns_time();
+	for (i=0; i<count; ++i) {
+		r = vm_evaluate(vm, &sigmoid, x);
+	}
+	t = ns_time() - t;
+	printf("%f\n", r);
+	if (1 < count) {
+		printf("%-11s: %.1f ns/evaluation\n",
+		       "evaluate",
+		       (double)t / (double)count);
+	}
+	vm_close(vm);
+	return 0;
+}
+
+struct expression {
+	struct parser *parser;
+	double *x; /* variable values, see parser_var() */
+};
+
+static int
+compiled(const struct expression *expressions,
+	 int n,
+	 uint64_t count,
+	 struct policy *policy)
 {
-	if (dag) {
-		reflect(dag->left, file);
-		reflect(dag->right, file);
+	const struct parser_dag **dags;
+	const struct parser_dag *dag;
+	uint64_t j, t, compile_ns, ns;
+	struct cache *cache;
+	struct unit *unit;
+	evaluate_t fnc;
+	int i, k;
+	double r;
+
+	/* all non-constant expressions share one unit and one gcc run */
+
+	if (!(dags = malloc(n * sizeof (dags[0])))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	for (i=0, k=0; i<n; ++i) {
+		dag = parser_dag(expressions[i].parser);
+		if (PARSER_DAG_VAL != dag->op) {
+			dags[k++] = dag;
+		}
+	}
+	cache = NULL;
+	unit = NULL;
+	compile_ns = ns_time();
+	if (k && (!(cache = cache_open(CACHEDIR, CACHESIZE)) ||
+		  !(unit = unit_open(dags, k, cache, policy, count)))) {
+		cache_close(cache);
+		FREE(dags);
+		TRACE(0);
+		return -1;
+	}
+	FREE(dags);
+	compile_ns = ns_time() - compile_ns;
+
+	/* evaluate, in the order given */
+
+	ns = 0;
+	for (i=0, k=0; i<n; ++i) {
+		dag = parser_dag(expressions[i].parser);
 		if (PARSER_DAG_VAL == dag->op) {
-			fprintf(file,
-				"double t%d = %f;\n",
-				dag->id,
-				dag->val);
-		}
-		else if (PARSER_DAG_NEG == dag->op) {
-			fprintf(file,
-				"double t%d = - t%d;\n",
-				dag->id,
-				dag->right->id);
-		}
-		else if (PARSER_DAG_MUL == dag->op) {
-			fprintf(file,
-				"double t%d = t%d * t%d;\n",
-				dag->id,
-				dag->left->id,
-				dag->right->id);
-		}
-		else if (PARSER_DAG_DIV == dag->op) {
-			fprintf(file,
-				"double t%d = t%d ? (t%d / t%d) : 0.0;\n",
-				dag->id,
-				dag->right->id,
-				dag->left->id,
-				dag->right->id);
-		}
-		else if (PARSER_DAG_ADD == dag->op) {
-			fprintf(file,
-				"double t%d = t%d + t%d;\n",
-				dag->id,
-				dag->left->id,
-				dag->right->id);
-		}
-		else if (PARSER_DAG_SUB == dag->op) {
-			fprintf(file,
-				"double t%d = t%d - t%d;\n",
-				dag->id,
-				dag->left->id,
-				dag->right->id);
+			printf("%f\n", sigmoid(dag->val));
+			continue;
 		}
-		else {
-			EXIT("software");
+		if (!(fnc = (evaluate_t)unit_lookup(unit, k++, "evaluate"))) {
+			unit_close(unit);
+			cache_close(cache);
+			TRACE(0);
+			return -1;
 		}
+		r = 0.0;
+		t = ns_time();
+		for (j=0; j<count; ++j) {
+			r = fnc(&sigmoid, expressions[i].x);
+		}
+		t = ns_time() - t;
+		ns += t;
+		if (policy) {
+			policy_evaluated(policy, unit_level(unit), dag->id, count, t);
+		}
+		printf("%f\n", r);
+	}
+	if (unit && (1 < count)) {
+		printf("%-11s: %.3f ms (-O%d)\n",
+		       "compile",
+		       (double)compile_ns / 1e6,
+		       (int)unit_level(unit));
+		printf("%-11s: %.1f ns/evaluation\n",
+		       "evaluate",
+		       (double)ns / (double)count / k);
+		printf("%-11s: %.3f ms\n",
+		       "total",
+		       (double)(compile_ns + ns) / 1e6);
 	}
+
+	/*	done */
+
+	unit_close(unit);
+	cache_close(cache);
+	return 0;
 }
 
-static void
-generate(const struct parser_dag *dag, FILE *file)
+/**
+ * Evaluates dag over rows copies of x with evaluate_batch(), on 1, 2, 4,
+ * ... threads up to one per CPU, reporting throughput and the scaling
+ * efficiency relative to one thread.
+ */
+
+static int
+batched(const struct parser_dag *dag,
+	const double *x,
+	int nvars,
+	uint64_t rows,
+	struct policy *policy)
 {
-	fprintf(file, "typedef double (*sigmoid_t)(double);\n");
-	fprintf(file, "double evaluate(sigmoid_t sigmoid) {\n");
-	reflect(dag, file);
-	fprintf(file, "return sigmoid(t%d);\n}\n", dag->id);
+	evaluate_batch_t fnc;
+	struct cache *cache;
+	struct batch *batch;
+	struct unit *unit;
+	double **cols, *out, base, rate;
+	int i, threads, max, e;
+	uint64_t j, t;
+
+	cache = NULL;
+	unit = NULL;
+	if (!(cache = cache_open(CACHEDIR, CACHESIZE)) ||
+	    !(unit = unit_open(&dag, 1, cache, policy, rows)) ||
+	    !(fnc = (evaluate_batch_t)unit_lookup(unit, 0, "evaluate_batch"))) {
+		unit_close(unit);
+		cache_close(cache);
+		TRACE(0);
+		return -1;
+	}
+	out = NULL;
+	if (!(cols = malloc((nvars + 1) * sizeof (cols[0])))) {
+		unit_close(unit);
+		cache_close(cache);
+		TRACE("out of memory");
+		return -1;
+	}
+	memset(cols, 0, (nvars + 1) * sizeof (cols[0]));
+	e = 0;
+	for (i=0; !e && (i<nvars); ++i) {
+		if (!(cols[i] = malloc(rows * sizeof (cols[i][0])))) {
+			TRACE("out of memory");
+			e = -1;
+			break;
+		}
+		for (j=0; j<rows; ++j) {
+			cols[i][j] = x[i];
+		}
+	}
+	if (!e && !(out = malloc(rows * sizeof (out[0])))) {
+		TRACE("out of memory");
+		e = -1;
+	}
+
+	/* scaling: the same rows on ever more threads */
+
+	max = 1;
+	if (!e && (batch = batch_open(0))) {
+		max = batch_threads(batch); /* one per CPU */
+		batch_close(batch);
+	}
+	base = 0.0;
+	for (threads=1; !e; threads=MIN(2 * threads, max)) {
+		if (!(batch = batch_open(threads)) ||
+		    batch_evaluate(batch,
+				   fnc,
+				   (const double *const *)cols,
+				   nvars,
+				   rows,
+				   out)) {
+			batch_close(batch);
+			TRACE(0);
+			e = -1;
+			break;
+		}
+		t = ns_time();
+		batch_evaluate(batch,
+			       fnc,
+			       (const double *const *)cols,
+			       nvars,
+			       rows,
+			       out);
+		t = ns_time() - t;
+		batch_close(batch);
+		if (1 == threads) {
+			printf("%f\n", out[0]);
+		}
+		if (1 < rows) {
+			rate = (double)rows / ((double)MAX(t, 1) / 1e9);
+			base = (1 == threads) ? rate : base;
+			printf("%-11s: %3d threads, %.1f Mrows/s, "
+			       "%.0f%% efficiency\n",
+			       "batch",
+			       threads,
+			       rate / 1e6,
+			       100.0 * rate / base / threads);
+		}
+		if ((1 >= rows) || (threads >= max)) {
+			break;
+		}
+	}
+	for (i=0; i<nvars; ++i) {
+		FREE(cols[i]);
+	}
+	FREE(cols);
+	FREE(out);
+	unit_close(unit);
+	cache_close(cache);
+	return e;
 }
 
-typedef double (*sigmoid_t)(double);
-typedef double (*evaluate_t)(sigmoid_t);
+/**
+ * Evaluates dag over rows copies of x with evaluate_batch() and with each
+ * evaluate_batchf_<w>() the host can run, up to codegen_float_symbol(),
+ * reporting throughput and the largest difference to double precision.
+ */
 
-int
-main(int argc, char *argv[])
+static int
+vectorized(const struct parser_dag *dag,
+	   const double *x,
+	   int nvars,
+	   uint64_t rows)
 {
-	const char *SOFILE = "out.so";
-	const char *CFILE = "out.c";
-	struct parser *parser;
+	const char *SYMBOLS[] = {
+		"evaluate_batch",
+		"evaluate_batchf_4",
+		"evaluate_batchf_8",
+		"evaluate_batchf_16"
+	};
+	evaluate_batchf_t fncf;
+	evaluate_batch_t fnc;
+	double **cols, *out, d, error;
+	float **colsf, *outf;
+	char pathname[64];
 	struct jitc *jitc;
-	evaluate_t fnc;
+	uint64_t j, t;
+	char *source;
+	size_t len;
 	FILE *file;
+	int i, fd, e;
 
-	/* usage */
+	/* one module with every variant */
 
-	if (2 != argc) {
-		printf("usage: %s expression\n", argv[0]);
+	jitc = NULL;
+	fd = -1;
+	source = NULL;
+	if (!(file = open_memstream(&source, &len))) {
+		TRACE("open_memstream()");
 		return -1;
 	}
+	e = codegen_float(dag, file);
+	fclose(file);
+	if (e ||
+	    (0 > (fd = jitc_memfd(pathname, sizeof (pathname)))) ||
+	    jitc_compile(source, pathname, JITC_O3) ||
+	    !(jitc = jitc_open(pathname))) {
+		FREE(source);
+		if (0 <= fd) {
+			close(fd);
+		}
+		TRACE(0);
+		return -1;
+	}
+	FREE(source);
 
-	/* parse */
+	/* columns in both precisions */
 
-	if (!(parser = parser_open(argv[1]))) {
+	e = 0;
+	cols = malloc((nvars + 1) * sizeof (cols[0]));
+	colsf = malloc((nvars + 1) * sizeof (colsf[0]));
+	out = malloc(rows * sizeof (out[0]));
+	outf = malloc(rows * sizeof (outf[0]));
+	if (!cols || !colsf || !out || !outf) {
+		TRACE("out of memory");
+		e = -1;
+	}
+	else {
+		memset(cols, 0, (nvars + 1) * sizeof (cols[0]));
+		memset(colsf, 0, (nvars + 1) * sizeof (colsf[0]));
+	}
+	for (i=0; !e && (i<nvars); ++i) {
+		cols[i] = malloc(rows * sizeof (cols[i][0]));
+		colsf[i] = malloc(rows * sizeof (colsf[i][0]));
+		if (!cols[i] || !colsf[i]) {
+			TRACE("out of memory");
+			e = -1;
+			break;
+		}
+		for (j=0; j<rows; ++j) {
+			cols[i][j] = x[i];
+			colsf[i][j] = (float)x[i];
+		}
+	}
+
+	/* double, then ever more lanes up to the host's */
+
+	for (i=0; !e && (i<(int)ARRAY_SIZE(SYMBOLS)); ++i) {
+		if (!i) {
+			if (!(fnc = (evaluate_batch_t)jitc_lookup(jitc, SYMBOLS[i]))) {
+				e = -1;
+				break;
+			}
+			fnc((const double *const *)cols, rows, out); /* warm */
+			t = ns_time();
+			fnc((const double *const *)cols, rows, out);
+			t = ns_time() - t;
+			printf("%f\n", out[0]);
+			error = 0.0;
+		}
+		else {
+			if (!(fncf = (evaluate_batchf_t)jitc_lookup(jitc,
+								  SYMBOLS[i]))) {
+				e = -1;
+				break;
+			}
+			fncf((const float *const *)colsf, rows, outf);
+			t = ns_time();
+			fncf((const float *const *)colsf, rows, outf);
+			t = ns_time() - t;
+			error = 0.0;
+			for (j=0; j<rows; ++j) {
+				d = fabs((double)outf[j] - out[j]);
+				error = (d > error) ? d : error;
+			}
+		}
+		if (1 < rows) {
+			printf("%-18s: %.1f Mrows/s, max error %.1e\n",
+			       SYMBOLS[i],
+			       (double)rows / ((double)MAX(t, 1) / 1e9) / 1e6,
+			       error);
+		}
+		if (!strcmp(SYMBOLS[i], codegen_float_symbol())) {
+			break;
+		}
+	}
+	for (i=0; cols && colsf && (i<nvars); ++i) {
+		FREE(cols[i]);
+		FREE(colsf[i]);
+	}
+	FREE(cols);
+	FREE(colsf);
+	FREE(out);
+	FREE(outf);
+	jitc_close(jitc);
+	close(fd);
+	if (e) {
 		TRACE(0);
 		return -1;
 	}
+	return 0;
+}
+
+/**
+ * Evaluates dag with evaluate_grad(), printing its value (without the
+ * sigmoid) and then its partial derivative with respect to each variable.
+ */
 
-	/* generate C */
+static int
+differentiated(const struct parser *parser, const double *x)
+{
+	const struct parser_dag *dag;
+	evaluate_grad_t fnc;
+	char pathname[64];
+	struct jitc *jitc;
+	double *grad, r;
+	char *source;
+	size_t len;
+	FILE *file;
+	int i, fd, e;
 
-	if (!(file = fopen(CFILE, "w"))) {
-		TRACE("fopen()");
+	dag = parser_dag(parser);
+	jitc = NULL;
+	fd = -1;
+	source = NULL;
+	if (!(file = open_memstream(&source, &len))) {
+		TRACE("open_memstream()");
 		return -1;
 	}
-	generate(parser_dag(parser), file);
-	parser_close(parser);
+	e = codegen_grad(dag, file);
 	fclose(file);
+	if (e ||
+	    (0 > (fd = jitc_memfd(pathname, sizeof (pathname)))) ||
+	    jitc_compile(source, pathname, JITC_O3) ||
+	    !(jitc = jitc_open(pathname)) ||
+	    !(fnc = (evaluate_grad_t)jitc_lookup(jitc, "evaluate_grad"))) {
+		jitc_close(jitc);
+		FREE(source);
+		if (0 <= fd) {
+			close(fd);
+		}
+		TRACE(0);
+		return -1;
+	}
+	FREE(source);
+	if (!(grad = malloc((parser_vars(parser) + 1) * sizeof (grad[0])))) {
+		jitc_close(jitc);
+		close(fd);
+		TRACE("out of memory");
+		return -1;
+	}
+	memset(grad, 0, (parser_vars(parser) + 1) * sizeof (grad[0]));
+	r = fnc(x, grad);
+	printf("%f\n", r);
+	for (i=0; i<parser_vars(parser); ++i) {
+		printf("d/d%-8s: %f\n", parser_var(parser, i), grad[i]);
+	}
+	FREE(grad);
+	jitc_close(jitc);
+	close(fd);
+	return 0;
+}
+
+/**
+ * Publishes the expressions in turn under a single name of a registry, each
+ * hot-swapping the previous one, and evaluates whichever is published count
+ * times, acquiring and releasing it around every evaluation.
+ */
 
-	/* JIT compile */
+static int
+swapped(const struct expression *expressions, int n, uint64_t count)
+{
+	struct registry_module *module;
+	const struct parser_dag *dag;
+	struct registry *registry;
+	char pathname[64];
+	uint64_t j, t;
+	evaluate_t fnc;
+	char *source;
+	size_t len;
+	FILE *file;
+	int i, e, *fds;
+	double r;
 
-	if (jitc_compile(CFILE, SOFILE)) {
-		file_delete(CFILE);
+	if (!(registry = registry_open(1, CACHESIZE))) {
 		TRACE(0);
 		return -1;
 	}
-	/*file_delete(CFILE);*/
+	if (!(fds = malloc(n * sizeof (fds[0])))) {
+		registry_close(registry);
+		TRACE("out of memory");
+		return -1;
+	}
+	for (i=0; i<n; ++i) {
+		fds[i] = -1;
+	}
+	e = 0;
+	for (i=0; !e && (i<n); ++i) {
+		dag = parser_dag(expressions[i].parser);
+		if (PARSER_DAG_VAL == dag->op) {
+			printf("%f\n", sigmoid(dag->val));
+			continue;
+		}
 
-	/* dynamic load */
+		/* every module keeps its memfd, so that no two share a pathname */
 
-	if (!(jitc = jitc_open(SOFILE)) ||
-	    !(fnc = (evaluate_t)jitc_lookup(jitc, "evaluate"))) {
-		file_delete(SOFILE);
-		jitc_close(jitc);
+		source = NULL;
+		if (!(file = open_memstream(&source, &len))) {
+			TRACE("open_memstream()");
+			e = -1;
+			break;
+		}
+		e = codegen(dag, file);
+		fclose(file);
+		if (e ||
+		    (0 > (fds[i] = jitc_memfd(pathname, sizeof (pathname)))) ||
+		    jitc_compile(source, pathname, JITC_O3) ||
+		    registry_publish(registry, "expression", pathname)) {
+			FREE(source);
+			TRACE(0);
+			e = -1;
+			break;
+		}
+		FREE(source);
+
+		/* evaluate */
+
+		r = 0.0;
+		t = ns_time();
+		for (j=0; j<count; ++j) {
+			if (!(module = registry_acquire(registry, "expression")) ||
+			    !(fnc = (evaluate_t)registry_lookup(module,
+								 "evaluate"))) {
+				if (module) {
+					registry_release(registry, module);
+				}
+				TRACE(0);
+				e = -1;
+				break;
+			}
+			r = fnc(&sigmoid, expressions[i].x);
+			registry_release(registry, module);
+		}
+		t = ns_time() - t;
+		if (!e) {
+			printf("%f\n", r);
+		}
+		if (!e && (1 < count)) {
+			printf("%-11s: %.1f ns/evaluation (acquired)\n",
+			       "evaluate",
+			       (double)t / (double)count);
+		}
+	}
+	registry_close(registry);
+	for (i=0; i<n; ++i) {
+		if (0 <= fds[i]) {
+			close(fds[i]);
+		}
+	}
+	FREE(fds);
+	return e;
+}
+
+/**
+ * Compiles dag once and evaluates it over every row of stdin, see
+ * stream_evaluate(), reporting the throughput on stderr (stdout carries the
+ * results). The stream is long by design, so no policy: always -O3.
+ */
+
+static int
+streamed(const struct parser *parser, enum stream_format format)
+{
+	const struct parser_dag *dag;
+	struct stream_stats stats;
+	evaluate_batch_t fnc;
+	struct cache *cache;
+	struct unit *unit;
+	double s;
+
+	dag = parser_dag(parser);
+	cache = NULL;
+	unit = NULL;
+	if (!(cache = cache_open(CACHEDIR, CACHESIZE)) ||
+	    !(unit = unit_open(&dag, 1, cache, NULL, UINT64_MAX)) ||
+	    !(fnc = (evaluate_batch_t)unit_lookup(unit, 0, "evaluate_batch")) ||
+	    stream_evaluate(parser, fnc, format, 0, 1, &stats)) {
+		unit_close(unit);
+		cache_close(cache);
 		TRACE(0);
 		return -1;
 	}
+	s = (double)MAX(stats.ns, 1) / 1e9;
+	fprintf(stderr,
+		"%-11s: %lu rows, %.1f MB/s, %.1f Mrows/s\n",
+		"stream",
+		(unsigned long)stats.rows,
+		(double)stats.bytes / s / 1e6,
+		(double)stats.rows / s / 1e6);
+	unit_close(unit);
+	cache_close(cache);
+	return 0;
+}
 
-	printf("%f\n", fnc(&sigmoid));
+static int
+tiered(const struct parser_dag *dag,
+       const double *x,
+       uint64_t count,
+       uint64_t threshold,
+       struct policy *policy)
+{
+	const char * const NAMES[] = { "interpreted", "compiled" };
+	struct tier_stats stats;
+	struct tier *tier;
+	uint64_t i, t;
+	double r;
+	int j;
 
-	/*	done */
+	t = ns_time();
+	if (!(tier = tier_open(dag, threshold, policy))) {
+		TRACE(0);
+		return -1;
+	}
+	r = 0.0;
+	for (i=0; i<count; ++i) {
+		r = tier_evaluate(tier, &sigmoid, x);
+	}
+	t = ns_time() - t;
+	printf("%f\n", r);
+	tier_stats(tier, &stats);
+	for (j=0; j<TIER_END; ++j) {
+		printf("%-11s: %lu evaluations, %.1f ns/evaluation\n",
+		       NAMES[j],
+		       (unsigned long)stats.evaluations[j],
+		       stats.evaluations[j] ?
+		       (double)stats.ns[j] / (double)stats.evaluations[j] : 0.0);
+	}
+	if (TIER_COMPILED == stats.level) {
+		printf("%-11s: %.3f ms (promoted, %d compiles, now -O%d)\n",
+		       "compile",
+		       (double)stats.compile_ns / 1e6,
+		       stats.compiles,
+		       (int)stats.opt);
+	}
+	else {
+		printf("%-11s: %.3f ms (not promoted)\n",
+		       "compile",
+		       (double)stats.compile_ns / 1e6);
+	}
+	printf("%-11s: %.3f ms\n", "total", (double)t / 1e6);
+	tier_close(tier);
+	return 0;
+}
 
-	file_delete(SOFILE);
-	jitc_close(jitc);
+/**
+ * Looks up the value of variable name among the name=value arguments.
+ */
+
+static int
+bind(const char *name, char *argv[], int argc, double *val)
+{
+	size_t n;
+	char *e;
+	int i;
+
+	n = safe_strlen(name);
+	for (i=0; i<argc; ++i) {
+		if (!strncmp(argv[i], name, n) && ('=' == argv[i][n])) {
+			*val = strtod(argv[i] + n + 1, &e);
+			if ((argv[i] + n + 1 == e) || (*e)) {
+				TRACE("invalid variable value");
+				return -1;
+			}
+			return 0;
+		}
+	}
+	fprintf(stderr, "error: variable '%s' is not bound\n", name);
+	return -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *POLICYFILE = ".jitc.policy";
+	struct expression *expressions;
+	uint64_t count, threshold;
+	const struct parser_dag *dag;
+	struct parser *parser;
+	struct policy *policy;
+	const char *backend, *precision, *format;
+	int i, j, k, n, e;
+
+	/* usage (options are exact words so that "-2" remains an expression) */
+
+	backend = "jitc";
+	precision = "exact";
+	format = NULL;
+	count = 1;
+	threshold = 1000;
+	for (i=1; (i + 1) < argc; i+=2) {
+		if (!strcmp(argv[i], "-b")) {
+			backend = argv[i + 1];
+		}
+		else if (!strcmp(argv[i], "-n")) {
+			count = strtoul(argv[i + 1], NULL, 10);
+		}
+		else if (!strcmp(argv[i], "-t")) {
+			threshold = strtoul(argv[i + 1], NULL, 10);
+		}
+		else if (!strcmp(argv[i], "-p")) {
+			precision = argv[i + 1];
+		}
+		else if (!strcmp(argv[i], "-s")) {
+			format = argv[i + 1];
+		}
+		else {
+			break;
+		}
+	}
+	for (n=0, k=0; ((i + n) < argc) && !strchr(argv[i + n], '='); ++n) {
+		if (!strcmp(argv[i + n], "@")) {
+			k = 1; /* no file name */
+		}
+	}
+	if (!n || k ||
+	    (strcmp(backend, "jitc") &&
+	     strcmp(backend, "x64") &&
+	     strcmp(backend, "tier") &&
+	     strcmp(backend, "vm") &&
+	     strcmp(backend, "batch") &&
+	     strcmp(backend, "float") &&
+	     strcmp(backend, "swap") &&
+	     strcmp(backend, "grad")) ||
+	    (strcmp(precision, "exact") && strcmp(precision, "fast")) ||
+	    (format &&
+	     (((1 != n) || ((i + n) != argc)) ||
+	      (strcmp(format, "csv") && strcmp(format, "binary"))))) {
+		printf("usage: %s [-b jitc|x64|tier|vm|batch|float|swap|grad] "
+		       "[-n count] [-t threshold] "
+		       "[-p exact|fast] "
+		       "expression|@file [expression|@file ...] "
+		       "[name=value ...]\n",
+		       argv[0]);
+		printf("       %s [-p exact|fast] -s csv|binary "
+		       "expression|@file < rows\n",
+		       argv[0]);
+		return -1;
+	}
+
+	/* parse and bind variables (constants fold in the chosen precision) */
+
+	intrinsic_precision(strcmp(precision, "fast") ?
+			    INTRINSIC_EXACT :
+			    INTRINSIC_FAST);
+
+	if (!(expressions = malloc(n * sizeof (expressions[0])))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	memset(expressions, 0, n * sizeof (expressions[0]));
+	e = 0;
+	for (k=0; !e && (k<n); ++k) {
+		if ('@' == argv[i + k][0]) {
+			parser = parser_load(argv[i + k] + 1);
+		}
+		else {
+			parser = parser_open(argv[i + k]);
+		}
+		if (!parser ||
+		    !(expressions[k].x = malloc((parser_vars(parser) + 1) *
+						sizeof (double)))) {
+			parser_close(parser);
+			e = -1;
+			break;
+		}
+		expressions[k].parser = parser;
+		for (j=0; !format && (j<parser_vars(parser)); ++j) {
+			if (bind(parser_var(parser, j),
+				 argv + i + n,
+				 argc - i - n,
+				 &expressions[k].x[j])) {
+				e = -1;
+				break;
+			}
+		}
+	}
+
+	/*
+	 * evaluate: folded, natively emitted, tiered, interpreted, or JIT
+	 * compiled, falling back to the VM when gcc fails (e.g. is missing)
+	 */
+
+	policy = NULL;
+	if (e) {
+		/* nothing */
+	}
+	else if (format) {
+		e = streamed(expressions[0].parser,
+			     strcmp(format, "csv") ? STREAM_BINARY : STREAM_CSV);
+		backend = "jitc"; /* done */
+	}
+	else if (!strcmp(backend, "swap")) {
+		e = swapped(expressions, n, count);
+		backend = "jitc"; /* done */
+	}
+	else if (strcmp(backend, "x64") &&
+		 strcmp(backend, "vm") &&
+		 strcmp(backend, "float") &&
+		 strcmp(backend, "grad") &&
+		 !(policy = policy_open(POLICYFILE))) {
+		e = -1;
+	}
+	else if (!strcmp(backend, "jitc") &&
+		 compiled(expressions, n, count, policy)) {
+		TRACE("jitc failed, falling back to the vm");
+		backend = "vm";
+	}
+	if (!e && strcmp(backend, "jitc")) {
+		for (k=0; !e && (k<n); ++k) {
+			dag = parser_dag(expressions[k].parser);
+			if (!strcmp(backend, "grad")) {
+				/* constants too: the value is printed without the sigmoid */
+				e = differentiated(expressions[k].parser,
+						   expressions[k].x);
+			}
+			else if (PARSER_DAG_VAL == dag->op) {
+				printf("%f\n", sigmoid(dag->val));
+			}
+			else if (!strcmp(backend, "x64")) {
+				e = native(dag, expressions[k].x);
+			}
+			else if (!strcmp(backend, "vm")) {
+				e = interpreted(dag, expressions[k].x, count);
+			}
+			else if (!strcmp(backend, "float")) {
+				e = vectorized(dag,
+					       expressions[k].x,
+					       parser_vars(expressions[k].parser),
+					       count);
+			}
+			else if (!strcmp(backend, "batch")) {
+				e = batched(dag,
+					    expressions[k].x,
+					    parser_vars(expressions[k].parser),
+					    count,
+					    policy);
+			}
+			else {
+				e = tiered(dag,
+					   expressions[k].x,
+					   count,
+					   threshold,
+					   policy);
+			}
+		}
+	}
+	policy_close(policy);
+	for (k=0; k<n; ++k) {
+		parser_close(expressions[k].parser);
+		FREE(expressions[k].x);
+	}
+	FREE(expressions);
+	if (e) {
+		TRACE(0);
+		return -1;
+	}
 	return 0;
 }
@@ -7,21 +7,19 @@
  * parser.c
  */
 
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "arena.h"
+#include "intrinsic.h"
 #include "lexer.h"
 #include "parser.h"
 
-#define MKD(p,d,o)					\
-	do {						\
-		size_t n = sizeof (struct parser_dag);	\
-		if (!((d) = malloc(n))) {		\
-			TRACE("out of memory");		\
-			return NULL;			\
-		}					\
-		memset((d), 0, n);			\
-		(d)->op = (o);				\
-		(d)->id = ++(p)->id;			\
-	}						\
-	while (0)
+#define CHUNK (1024 * sizeof (struct parser_dag))
 
 #define TRACE_ONCE(p,m)				\
 	do {					\
@@ -34,29 +32,142 @@
 struct parser {
 	int id; /* global id */
 	int stop;
-	uint64_t i; /* current token */
-	uint64_t n; /* total tokens */
+	const struct lexer_token *token; /* current, NULL after a lexer error */
 	struct lexer *lexer;
+	struct arena *arena; /* scratch, including every node ever built */
 	struct parser_dag *dag;
+	struct parser_dag *nodes; /* once parsed, see compact() */
+	int nvars;
+	char (*vars)[LEXER_NAME_MAX]; /* in order of first appearance */
+	struct {
+		struct parser_dag **nodes; /* open addressing, NULL is empty */
+		uint64_t size; /* power of two */
+	} intern;
 };
 
-static void
-free_dag(struct parser_dag *dag)
+static uint64_t
+hash(enum parser_dag_op op,
+     double val,
+     int var,
+     const struct parser_dag *left,
+     const struct parser_dag *right)
+{
+	uint64_t h, bits;
+
+	memcpy(&bits, &val, sizeof (bits));
+	h = (uint64_t)op;
+	h = (h ^ bits) * 0x9e3779b97f4a7c15;
+	h = (h ^ (uint64_t)var) * 0x9e3779b97f4a7c15;
+	h = (h ^ (uint64_t)(size_t)left) * 0x9e3779b97f4a7c15;
+	h = (h ^ (uint64_t)(size_t)right) * 0x9e3779b97f4a7c15;
+	return h ^ (h >> 29);
+}
+
+static int /* BOOL */
+same(const struct parser_dag *dag,
+     enum parser_dag_op op,
+     double val,
+     int var,
+     const struct parser_dag *left,
+     const struct parser_dag *right)
 {
-	if (dag) {
-		free_dag(dag->left);
-		free_dag(dag->right);
+	return (op == dag->op) &&
+		!memcmp(&val, &dag->val, sizeof (val)) &&
+		(var == dag->var) &&
+		(left == dag->left) &&
+		(right == dag->right);
+}
+
+static int
+grow(struct parser *parser)
+{
+	struct parser_dag **nodes, *dag;
+	uint64_t i, j, size;
+
+	size = parser->intern.size ? (2 * parser->intern.size) : 64;
+	if (!(nodes = malloc(size * sizeof (nodes[0])))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	memset(nodes, 0, size * sizeof (nodes[0]));
+	for (i=0; i<parser->intern.size; ++i) {
+		if ((dag = parser->intern.nodes[i])) {
+			j = hash(dag->op, dag->val, dag->var, dag->left, dag->right);
+			while (nodes[j & (size - 1)]) {
+				++j;
+			}
+			nodes[j & (size - 1)] = dag;
+		}
 	}
-	FREE(dag);
+	FREE(parser->intern.nodes);
+	parser->intern.nodes = nodes;
+	parser->intern.size = size;
+	return 0;
+}
+
+/**
+ * Returns the unique node for (op, val, var, left, right), creating it on first
+ * use. Since children are interned before their parents, structurally
+ * identical subexpressions are the same node and ids are handed out in
+ * post-order.
+ */
+
+static struct parser_dag *
+mkd(struct parser *parser,
+    enum parser_dag_op op,
+    double val,
+    int var,
+    struct parser_dag *left,
+    struct parser_dag *right)
+{
+	struct parser_dag *dag;
+	uint64_t i;
+
+	if ((uint64_t)(parser->id + 1) * 2 >= parser->intern.size) {
+		if (grow(parser)) {
+			TRACE(0);
+			return NULL;
+		}
+	}
+	i = hash(op, val, var, left, right);
+	while ((dag = parser->intern.nodes[i & (parser->intern.size - 1)])) {
+		if (same(dag, op, val, var, left, right)) {
+			return dag;
+		}
+		++i;
+	}
+	if (!(dag = arena_alloc(parser->arena, sizeof (struct parser_dag)))) {
+		TRACE(0);
+		return NULL;
+	}
+	dag->op = op;
+	dag->val = val;
+	dag->var = var;
+	dag->id = ++parser->id;
+	dag->left = left;
+	dag->right = right;
+	parser->intern.nodes[i & (parser->intern.size - 1)] = dag;
+	return dag;
+}
+
+static void
+free_dag(struct parser *parser)
+{
+	FREE(parser->intern.nodes);
+	parser->intern.size = 0;
+	arena_close(parser->arena);
+	parser->arena = NULL;
+	FREE(parser->nodes);
+	parser->dag = NULL;
 }
 
 static const struct lexer_token *
 next(const struct parser *parser)
 {
-	static const struct lexer_token SENTINEL = { LEXER_OP_, 0.0 };
+	static const struct lexer_token SENTINEL = { LEXER_OP_, 0.0, "" };
 
-	if (parser->i < parser->n) {
-		return lexer_lookup(parser->lexer, parser->i);
+	if (parser->token) {
+		return parser->token;
 	}
 	return &SENTINEL;
 }
@@ -75,239 +186,682 @@ match(const struct parser *parser, enum lexer_token_op op)
 static void
 forward(struct parser *parser)
 {
-	if (parser->i < parser->n) {
-		++parser->i;
+	if (parser->token && (LEXER_OP_ != parser->token->op)) {
+		if (!(parser->token = lexer_next(parser->lexer))) {
+			parser->stop = 1; /* the lexer reported it */
+		}
 	}
 }
 
 /**
- * expr_primary : VAL
- *              | '(' expr ')'
+ * Returns the index of the variable called name, adding it on first use,
+ * or -1 on error.
  */
 
-static struct parser_dag *expr(struct parser *parser);
+static int
+variable(struct parser *parser, const char *name)
+{
+	char (*vars)[LEXER_NAME_MAX];
+	int i;
 
-static struct parser_dag *
-expr_primary(struct parser *parser)
+	for (i=0; i<parser->nvars; ++i) {
+		if (!strcmp(parser->vars[i], name)) {
+			return i;
+		}
+	}
+	if (!(parser->nvars % 16)) {
+		vars = realloc(parser->vars,
+			       (parser->nvars + 16) * sizeof (vars[0]));
+		if (!vars) {
+			TRACE("out of memory");
+			return -1;
+		}
+		parser->vars = vars;
+	}
+	safe_sprintf(parser->vars[parser->nvars],
+		     sizeof (parser->vars[0]),
+		     "%s",
+		     name);
+	return parser->nvars++;
+}
+
+/**
+ * expr    : unary { [ '+' '-' '*' '/' ] unary }
+ * unary   : { [ '+' '-' ] } primary
+ * primary : VAL
+ *         | VAR
+ *         | CALL '(' expr ')'
+ *         | '(' expr ')'
+ *
+ * CALL is the name of an intrinsic: exp, log, tanh or sigmoid; these names
+ * are reserved. A call is a prefix operator that owns its parentheses.
+ * Unary operators and calls bind tightest, then '*' and '/', then '+' and
+ * '-'; binary operators associate to the left. Parsing is
+ * operator-precedence (shunting yard) over explicit stacks, so neither deep
+ * nesting nor long chains use the C stack, and each token is handled in
+ * constant amortized time.
+ */
+
+enum op {
+	OP_OPEN, /* '(' */
+	OP_ADD,
+	OP_SUB,
+	OP_MUL,
+	OP_DIV,
+	OP_POS, /* unary '+' */
+	OP_NEG, /* unary '-', the first unary operator yielding a node */
+	OP_EXP,
+	OP_LOG,
+	OP_TANH,
+	OP_SIGMOID
+};
+
+static const int PRECEDENCE[] = { 0, 1, 1, 2, 2, 3, 3, 3, 3, 3, 3 };
+
+static const enum parser_dag_op DAG_OP[] = {
+	PARSER_DAG_,
+	PARSER_DAG_ADD,
+	PARSER_DAG_SUB,
+	PARSER_DAG_MUL,
+	PARSER_DAG_DIV,
+	PARSER_DAG_,
+	PARSER_DAG_NEG,
+	PARSER_DAG_EXP,
+	PARSER_DAG_LOG,
+	PARSER_DAG_TANH,
+	PARSER_DAG_SIGMOID
+};
+
+/* the names of the calls, OP_EXP onward */
+
+static const char * const CALL[] = { "exp", "log", "tanh", "sigmoid" };
+
+/* reported when the operator is missing its (right) operand */
+
+static const char * const MISSING[] = {
+	"invalid sub-expression",
+	"invalid '+' operand",
+	"invalid '-' operand",
+	"invalid '*' operand",
+	"invalid '/' operand",
+	"invalid unary '+' operand",
+	"invalid unary '-' operand",
+	"invalid 'exp' argument",
+	"invalid 'log' argument",
+	"invalid 'tanh' argument",
+	"invalid 'sigmoid' argument"
+};
+
+struct stack {
+	enum op *ops;
+	struct parser_dag **operands;
+	uint64_t nops;
+	uint64_t noperands;
+	uint64_t capacity; /* of each */
+};
+
+/**
+ * Makes room for pushing one more operator and one more operand.
+ */
+
+static int
+reserve(struct stack *stack)
+{
+	struct parser_dag **operands;
+	uint64_t capacity;
+	enum op *ops;
+
+	if ((stack->nops < stack->capacity) &&
+	    (stack->noperands < stack->capacity)) {
+		return 0;
+	}
+	capacity = stack->capacity ? (2 * stack->capacity) : 256;
+	if (!(ops = realloc(stack->ops, capacity * sizeof (ops[0])))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	stack->ops = ops;
+	if (!(operands = realloc(stack->operands,
+				 capacity * sizeof (operands[0])))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	stack->operands = operands;
+	stack->capacity = capacity;
+	return 0;
+}
+
+/**
+ * Pops the topmost operator and applies it to the topmost operand(s).
+ */
+
+static int
+reduce(struct parser *parser, struct stack *stack)
+{
+	struct parser_dag *left, *right, *dag;
+	enum op op;
+
+	op = stack->ops[--stack->nops];
+	if (OP_POS == op) {
+		return 0;
+	}
+	right = stack->operands[--stack->noperands];
+	left = NULL;
+	if (OP_NEG > op) {
+		left = stack->operands[--stack->noperands];
+	}
+	if (!(dag = mkd(parser, DAG_OP[op], 0.0, 0, left, right))) {
+		TRACE_ONCE(parser, 0);
+		return -1;
+	}
+	stack->operands[stack->noperands++] = dag;
+	return 0;
+}
+
+/**
+ * Pushes the call op and the '(' that must follow its name, so that the
+ * matching ')' leaves op to be reduced like any unary operator.
+ */
+
+static int
+call(struct parser *parser, struct stack *stack, enum op op)
+{
+	forward(parser);
+	if (!match(parser, LEXER_OP_OPEN)) {
+		TRACE_ONCE(parser, "expecting '(' after intrinsic");
+		return -1;
+	}
+	stack->ops[stack->nops++] = op;
+	if (reserve(stack)) {
+		TRACE_ONCE(parser, 0);
+		return -1;
+	}
+	stack->ops[stack->nops++] = OP_OPEN;
+	forward(parser);
+	return 0;
+}
+
+/**
+ * Parses an operand's prefix operators and primary, returning 1 once the
+ * primary is on the operand stack, 0 if only a prefix was consumed, or -1
+ * on error.
+ */
+
+static int
+operand(struct parser *parser, struct stack *stack)
 {
 	struct parser_dag *dag;
+	int var, i;
 
-	dag = NULL;
-	if (match(parser, LEXER_OP_VAL)) {
-		MKD(parser, dag, PARSER_DAG_VAL);
-		dag->val = next(parser)->val;
+	if (reserve(stack)) {
+		TRACE_ONCE(parser, 0);
+		return -1;
+	}
+	if (match(parser, LEXER_OP_ADD)) {
+		stack->ops[stack->nops++] = OP_POS;
 		forward(parser);
+		return 0;
 	}
-	else if (match(parser, LEXER_OP_OPEN)) {
+	if (match(parser, LEXER_OP_SUB)) {
+		stack->ops[stack->nops++] = OP_NEG;
 		forward(parser);
-		if (!(dag = expr(parser))) {
-			TRACE_ONCE(parser, "invalid sub-expression");
-			return NULL;
+		return 0;
+	}
+	if (match(parser, LEXER_OP_OPEN)) {
+		stack->ops[stack->nops++] = OP_OPEN;
+		forward(parser);
+		return 0;
+	}
+	if (match(parser, LEXER_OP_VAL)) {
+		dag = mkd(parser, PARSER_DAG_VAL, next(parser)->val, 0, NULL, NULL);
+	}
+	else if (match(parser, LEXER_OP_VAR)) {
+		for (i=0; i<(int)ARRAY_SIZE(CALL); ++i) {
+			if (!strcmp(next(parser)->name, CALL[i])) {
+				return call(parser, stack, (enum op)(OP_EXP + i));
+			}
 		}
-		if (!match(parser, LEXER_OP_CLOSE)) {
-			TRACE_ONCE(parser, "expecting ')'");
-			return NULL;
+		dag = NULL;
+		if (0 <= (var = variable(parser, next(parser)->name))) {
+			dag = mkd(parser, PARSER_DAG_VAR, 0.0, var, NULL, NULL);
 		}
-		forward(parser);
 	}
-	return dag;
+	else {
+		TRACE_ONCE(parser,
+			   stack->nops ?
+			   MISSING[stack->ops[stack->nops - 1]] :
+			   "invalid expression");
+		return -1;
+	}
+	if (!dag) {
+		TRACE_ONCE(parser, 0);
+		return -1;
+	}
+	stack->operands[stack->noperands++] = dag;
+	forward(parser);
+	return 1;
 }
 
 /**
- * expr_unary : [ '+' '-' ] exr_unary
- *            | expr_primary
+ * Parses the operator following an operand, reducing every pending operator
+ * that binds at least as tightly first. Returns 2 after a binary operator
+ * (an operand follows), 1 after a ')' (an operator follows), 0 at the end of
+ * the expression, or -1 on error.
  */
 
-static struct parser_dag *
-expr_unary(struct parser *parser)
+static int
+operator(struct parser *parser, struct stack *stack)
 {
-	struct parser_dag *dag;
+	enum op op;
 
-	dag = NULL;
 	if (match(parser, LEXER_OP_ADD)) {
-		forward(parser);
-		if (!(dag = expr_unary(parser))) {
-			TRACE_ONCE(parser, "invalid unary '+' operand");
-			return NULL;
-		}
+		op = OP_ADD;
 	}
 	else if (match(parser, LEXER_OP_SUB)) {
-		MKD(parser, dag, PARSER_DAG_NEG);
-		forward(parser);
-		if (!(dag->right = expr_unary(parser))) {
-			TRACE_ONCE(parser, "invalid unary '-' operand");
-			return NULL;
+		op = OP_SUB;
+	}
+	else if (match(parser, LEXER_OP_MUL)) {
+		op = OP_MUL;
+	}
+	else if (match(parser, LEXER_OP_DIV)) {
+		op = OP_DIV;
+	}
+	else if (match(parser, LEXER_OP_CLOSE)) {
+		while (stack->nops && (OP_OPEN != stack->ops[stack->nops - 1])) {
+			if (reduce(parser, stack)) {
+				return -1;
+			}
+		}
+		if (!stack->nops) {
+			return 0; /* unbalanced, see top() */
 		}
+		--stack->nops;
+		forward(parser);
+		return 1;
 	}
 	else {
-		dag = expr_primary(parser);
+		return 0;
 	}
-	return dag;
+	if (reserve(stack)) {
+		TRACE_ONCE(parser, 0);
+		return -1;
+	}
+	while (stack->nops &&
+	       (PRECEDENCE[stack->ops[stack->nops - 1]] >= PRECEDENCE[op])) {
+		if (reduce(parser, stack)) {
+			return -1;
+		}
+	}
+	stack->ops[stack->nops++] = op;
+	forward(parser);
+	return 2;
 }
 
 /**
- * expr_multiplicative_ : { [ '*' '/' ] expr_unary expr_multiplicative_ }
- *                      | âˆ…
- *
- * expr_multiplicative : expr_unary expr_multiplicative_
+ * top : expr
  */
 
 static struct parser_dag *
-expr_multiplicative_(struct parser *parser, struct parser_dag *left)
+top(struct parser *parser)
 {
-	const char * const TBL[] = { "*", "/" };
 	struct parser_dag *dag;
-	char buf[64];
+	struct stack stack;
+	int r;
 
-	dag = left;
+	memset(&stack, 0, sizeof (struct stack));
+	dag = NULL;
 	for (;;) {
-		if (match(parser, LEXER_OP_MUL)) {
-			MKD(parser, dag, PARSER_DAG_MUL);
-			dag->left = left;
-			forward(parser);
+		while (!(r = operand(parser, &stack))) {
+		}
+		if (0 > r) {
+			break;
 		}
-		else if (match(parser, LEXER_OP_DIV)) {
-			MKD(parser, dag, PARSER_DAG_DIV);
-			dag->left = left;
-			forward(parser);
+		while (1 == (r = operator(parser, &stack))) {
 		}
-		else {
+		if (0 >= r) {
 			break;
 		}
-		if (!(dag->right = expr_unary(parser))) {
-			safe_sprintf(buf,
-				     sizeof (buf),
-				     "invalid '%s' operand",
-				     TBL[dag->op - PARSER_DAG_MUL]);
-			TRACE_ONCE(parser, buf);
-			return NULL;
+	}
+	while (!r && stack.nops) {
+		if (OP_OPEN == stack.ops[stack.nops - 1]) {
+			TRACE_ONCE(parser, "expecting ')'");
+			r = -1;
 		}
-		if (!(dag = expr_multiplicative_(parser, dag))) {
-			TRACE_ONCE(parser, 0);
-			return NULL;
+		else if (reduce(parser, &stack)) {
+			r = -1;
+		}
+	}
+	if (!r) {
+		if (!parser->token) {
+			/* the lexer failed, the rest of the input is lost */
+		}
+		else if (!match(parser, LEXER_OP_)) {
+			TRACE_ONCE(parser, "bogus trailing content");
 		}
+		else {
+			assert( 1 == stack.noperands );
+
+			dag = stack.operands[0];
+		}
+	}
+	FREE(stack.ops);
+	FREE(stack.operands);
+	if (!dag) {
+		TRACE_ONCE(parser, "invalid expression");
 	}
 	return dag;
 }
 
-static struct parser_dag *
-expr_multiplicative(struct parser *parser)
+/**
+ * Optimization: constant folding and algebraic simplification. Each node is
+ * rebuilt bottom-up through mkd(), so rewritten subexpressions stay shared.
+ * Folding follows the semantics of the generated code, in particular
+ * division by zero yields 0.0 and intrinsics are computed in the current
+ * precision.
+ */
+
+static int /* BOOL */
+is_val(const struct parser_dag *dag, double val)
 {
-	struct parser_dag *dag;
+	return dag && (PARSER_DAG_VAL == dag->op) && (val == dag->val);
+}
 
-	if (!(dag = expr_unary(parser))) {
-		return NULL;
-	}
-	return expr_multiplicative_(parser, dag);
+static int /* BOOL */
+is_const(const struct parser_dag *dag)
+{
+	return !dag || (PARSER_DAG_VAL == dag->op);
 }
 
-/**
- * expr_additive_ : { [ '+' '-' ] expr_multiplicative expr_additive_ }
- *                | âˆ…
- *
- * expr_additive : expr_multiplicative expr_additive_
- */
+static double
+fold(enum parser_dag_op op, double l, double r)
+{
+	if (PARSER_DAG_NEG == op) {
+		return - r;
+	}
+	if (PARSER_DAG_EXP == op) {
+		return intrinsic_exp(r);
+	}
+	if (PARSER_DAG_LOG == op) {
+		return intrinsic_log(r);
+	}
+	if (PARSER_DAG_TANH == op) {
+		return intrinsic_tanh(r);
+	}
+	if (PARSER_DAG_SIGMOID == op) {
+		return intrinsic_sigmoid(r);
+	}
+	if (PARSER_DAG_MUL == op) {
+		return l * r;
+	}
+	if (PARSER_DAG_DIV == op) {
+		return r ? (l / r) : 0.0;
+	}
+	if (PARSER_DAG_ADD == op) {
+		return l + r;
+	}
+	if (PARSER_DAG_SUB == op) {
+		return l - r;
+	}
+	EXIT("software");
+	return 0.0;
+}
 
 static struct parser_dag *
-expr_additive_(struct parser *parser, struct parser_dag *left)
+simplify(struct parser *parser,
+	 const struct parser_dag *dag,
+	 struct parser_dag *left,
+	 struct parser_dag *right)
 {
-	const char * const TBL[] = { "+", "-" };
-	struct parser_dag *dag;
-	char buf[64];
+	enum parser_dag_op op;
+	struct parser_dag *c;
+	double r;
 
-	dag = left;
-	for (;;) {
-		if (match(parser, LEXER_OP_ADD)) {
-			MKD(parser, dag, PARSER_DAG_ADD);
-			dag->left = left;
-			forward(parser);
+	op = dag->op;
+	if ((PARSER_DAG_VAL == op) || (PARSER_DAG_VAR == op)) {
+		return mkd(parser, op, dag->val, dag->var, NULL, NULL);
+	}
+	if (is_const(left) && is_const(right)) {
+		return mkd(parser,
+			   PARSER_DAG_VAL,
+			   fold(op,
+				left ? left->val : 0.0,
+				right ? right->val : 0.0),
+			   0,
+			   NULL,
+			   NULL);
+	}
+	if ((PARSER_DAG_NEG == op) && (PARSER_DAG_NEG == right->op)) {
+		return right->right;
+	}
+	if (PARSER_DAG_MUL == op) {
+		if (is_val(right, 1.0)) {
+			return left;
 		}
-		else if (match(parser, LEXER_OP_SUB)) {
-			MKD(parser, dag, PARSER_DAG_SUB);
-			dag->left = left;
-			forward(parser);
+		if (is_val(left, 1.0)) {
+			return right;
 		}
-		else {
-			break;
+	}
+	if (PARSER_DAG_DIV == op) {
+		if (is_val(right, 0.0)) {
+			return mkd(parser, PARSER_DAG_VAL, 0.0, 0, NULL, NULL);
 		}
-		if (!(dag->right = expr_multiplicative(parser))) {
-			safe_sprintf(buf,
-				     sizeof (buf),
-				     "invalid '%s' operand",
-				     TBL[dag->op - PARSER_DAG_MUL]);
-			TRACE_ONCE(parser, buf);
-			return NULL;
+		if (is_val(right, 1.0)) {
+			return left;
 		}
-		if (!(dag = expr_additive_(parser, dag))) {
-			TRACE_ONCE(parser, 0);
-			return NULL;
+		if (is_const(right) &&
+		    (r = 1.0 / right->val) &&
+		    ((r - r) == 0.0)) {
+			/* the reciprocal is finite and non-zero */
+			if (!(c = mkd(parser, PARSER_DAG_VAL, r, 0, NULL, NULL))) {
+				return NULL;
+			}
+			return mkd(parser, PARSER_DAG_MUL, 0.0, 0, left, c);
 		}
 	}
-	return dag;
+	if (PARSER_DAG_ADD == op) {
+		if (is_val(right, 0.0)) {
+			return left;
+		}
+		if (is_val(left, 0.0)) {
+			return right;
+		}
+	}
+	if (PARSER_DAG_SUB == op) {
+		if (is_val(right, 0.0)) {
+			return left;
+		}
+		if (is_val(left, 0.0)) {
+			return mkd(parser, PARSER_DAG_NEG, 0.0, 0, NULL, right);
+		}
+	}
+	return mkd(parser, op, 0.0, 0, left, right);
 }
 
-static struct parser_dag *
-expr_additive(struct parser *parser)
+/**
+ * Assigns dense post-order ids to the n or fewer nodes reachable from the
+ * root, whose ids must be cleared. The explicit stack holds a path from the
+ * root, i.e., distinct nodes, so n entries always suffice.
+ */
+
+static int
+renumber(struct parser *parser, uint64_t n)
 {
-	struct parser_dag *dag;
+	struct parser_dag **stack, *dag;
+	uint64_t k;
 
-	if (!(dag = expr_multiplicative(parser))) {
-		return NULL;
+	if (!(stack = arena_alloc(parser->arena, n * sizeof (stack[0])))) {
+		TRACE(0);
+		return -1;
 	}
-	return expr_additive_(parser, dag);
+	k = 0;
+	stack[k++] = parser->dag;
+	while (k) {
+		dag = stack[k - 1];
+		if (dag->left && !dag->left->id) {
+			stack[k++] = dag->left;
+		}
+		else if (dag->right && !dag->right->id) {
+			stack[k++] = dag->right;
+		}
+		else {
+			dag->id = ++parser->id;
+			--k;
+		}
+	}
+	return 0;
 }
 
-/**
- * expr : expr_additive
- */
-
-static struct parser_dag *
-expr(struct parser *parser)
+static int
+optimize(struct parser *parser)
 {
-	return expr_additive(parser);
+	const struct parser_dag **order, *dag;
+	struct parser_dag **map;
+	uint64_t i;
+	int n, j;
+
+	n = parser->dag->id;
+	order = arena_alloc(parser->arena, (size_t)n * sizeof (order[0]));
+	map = arena_alloc(parser->arena, (size_t)n * sizeof (map[0]));
+	if (!order || !map) {
+		TRACE(0);
+		return -1;
+	}
+	parser_order(parser->dag, order);
+	for (j=0; j<n; ++j) {
+		dag = order[j];
+		if (!(map[j] = simplify(parser,
+					dag,
+					dag->left ? map[dag->left->id - 1] : NULL,
+					dag->right ? map[dag->right->id - 1] : NULL))) {
+			TRACE(0);
+			return -1;
+		}
+	}
+	parser->dag = map[n - 1];
+
+	/* restore dense post-order ids over the nodes still reachable */
+
+	for (i=0; i<parser->intern.size; ++i) {
+		if (parser->intern.nodes[i]) {
+			parser->intern.nodes[i]->id = 0;
+		}
+	}
+	i = (uint64_t)parser->id;
+	parser->id = 0;
+	if (renumber(parser, i)) {
+		TRACE(0);
+		return -1;
+	}
+	return 0;
 }
 
 /**
- * top : expr
+ * Moves the nodes reachable from the root into a single array, in id order,
+ * then releases the scratch arena: everything else built while parsing and
+ * optimizing. Walking the nodes in order then reads memory sequentially.
  */
 
-static struct parser_dag *
-top(struct parser *parser)
+static int
+compact(struct parser *parser)
 {
-	struct parser_dag *dag;
+	const struct parser_dag **order;
+	struct parser_dag *nodes;
+	int n, j;
 
-	if (!(dag = expr(parser))) {
-		TRACE_ONCE(parser, "invalid expression");
-		return NULL;
+	n = parser->dag->id;
+	if (!(order = arena_alloc(parser->arena, (size_t)n * sizeof (order[0]))) ||
+	    !(nodes = malloc((size_t)n * sizeof (nodes[0])))) {
+		TRACE("out of memory");
+		return -1;
 	}
-	if (!match(parser, LEXER_OP_)) {
-		TRACE_ONCE(parser, "bogus trailing content");
-		return NULL;
+	parser_order(parser->dag, order);
+	for (j=0; j<n; ++j) {
+		nodes[j] = *order[j];
+		if (order[j]->left) {
+			nodes[j].left = &nodes[order[j]->left->id - 1];
+		}
+		if (order[j]->right) {
+			nodes[j].right = &nodes[order[j]->right->id - 1];
+		}
 	}
-	return dag;
+	free_dag(parser);
+	parser->nodes = nodes;
+	parser->dag = &nodes[n - 1];
+	return 0;
 }
 
-struct parser *
-parser_open(const char *s)
+static struct parser *
+parse(const char *s, size_t len)
 {
 	struct parser *parser;
 
-	assert( safe_strlen(s) );
-
 	if (!(parser = malloc(sizeof (struct parser)))) {
 		TRACE("out of memory");
 		return NULL;
 	}
 	memset(parser, 0, sizeof (struct parser));
-	if (!(parser->lexer = lexer_open(s)) ||
-	    !(parser->n = lexer_size(parser->lexer)) ||
-	    !(parser->dag = top(parser))) {
+	if (!(parser->arena = arena_open(CHUNK)) ||
+	    !(parser->lexer = lexer_open(s, len)) ||
+	    !(parser->token = lexer_next(parser->lexer)) ||
+	    !(parser->dag = top(parser)) ||
+	    optimize(parser) ||
+	    compact(parser)) {
 		parser_close(parser);
 		TRACE(0);
 		return NULL;
 	}
 	lexer_close(parser->lexer);
 	parser->lexer = NULL;
+	parser->token = NULL;
+	return parser;
+}
+
+struct parser *
+parser_open(const char *s)
+{
+	assert( safe_strlen(s) );
+
+	return parse(s, safe_strlen(s));
+}
+
+struct parser *
+parser_load(const char *pathname)
+{
+	struct parser *parser;
+	struct stat st;
+	size_t len;
+	void *s;
+	int fd;
+
+	assert( safe_strlen(pathname) );
+
+	if (0 > (fd = open(pathname, O_RDONLY))) {
+		TRACE("open()");
+		return NULL;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		TRACE("fstat()");
+		return NULL;
+	}
+	if (!(len = (size_t)st.st_size)) {
+		close(fd);
+		TRACE("empty expression file");
+		return NULL;
+	}
+	s = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (MAP_FAILED == s) {
+		TRACE("mmap()");
+		return NULL;
+	}
+	if (madvise(s, len, MADV_SEQUENTIAL)) {
+		/* ignore */
+	}
+	if (!(parser = parse((const char *)s, len))) {
+		TRACE(0);
+	}
+	munmap(s, len);
 	return parser;
 }
 
@@ -315,17 +869,62 @@ void
 parser_close(struct parser *parser)
 {
 	if (parser) {
-		free_dag(parser->dag);
+		free_dag(parser);
 		lexer_close(parser->lexer);
+		FREE(parser->vars);
 		memset(parser, 0, sizeof (struct parser));
 	}
 	FREE(parser);
 }
 
+void
+parser_order(const struct parser_dag *dag, const struct parser_dag **order)
+{
+	int i;
+
+	assert( dag && order );
+
+	/*
+	 * Ids are dense and every node has a larger id than its children, so
+	 * visiting ids in decreasing order reaches each node through a parent
+	 * before the node itself: no recursion, no stack.
+	 */
+
+	memset((void *)order, 0, (size_t)dag->id * sizeof (order[0]));
+	order[dag->id - 1] = dag;
+	for (i=dag->id-1; i>=0; --i) {
+		dag = order[i];
+		assert( dag && (dag->id == (i + 1)) );
+		if (dag->left) {
+			order[dag->left->id - 1] = dag->left;
+		}
+		if (dag->right) {
+			order[dag->right->id - 1] = dag->right;
+		}
+	}
+}
+
 const struct parser_dag *
 parser_dag(const struct parser *parser)
 {
 	assert( parser );
 
 	return parser->dag;
+}
+
+int
+parser_vars(const struct parser *parser)
+{
+	assert( parser );
+
+	return parser->nvars;
+}
+
+const char *
+parser_var(const struct parser *parser, int i)
+{
+	assert( parser );
+	assert( (0 <= i) && (i < parser->nvars) );
+
+	return parser->vars[i];
 }
\ No newline at end of file
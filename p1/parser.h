@@ -18,20 +18,70 @@ struct parser_dag {
 		PARSER_DAG_MUL, /* left * right */
 		PARSER_DAG_DIV, /* left / right */
 		PARSER_DAG_ADD, /* left + right */
-		PARSER_DAG_SUB  /* left - right */
+		PARSER_DAG_SUB, /* left - right */
+		PARSER_DAG_VAR, /* x[var] */
+		PARSER_DAG_EXP, /* exp(right), see intrinsic.h */
+		PARSER_DAG_LOG, /* log(right) */
+		PARSER_DAG_TANH, /* tanh(right) */
+		PARSER_DAG_SIGMOID /* sigmoid(right) */
 	} op;
 	double val;
-	int id; /* guaranteed to be unique */
+	int var; /* PARSER_DAG_VAR: index of the variable, see parser_var() */
+	int id; /* guaranteed to be unique, see below */
 	struct parser_dag *left;
 	struct parser_dag *right;
 };
 
+/**
+ * The expression is optimized as it is parsed: constant subexpressions are
+ * folded and identities (x*1, x+0, --x, ...) removed, so a constant
+ * expression is a single PARSER_DAG_VAL node.
+ *
+ * Structurally identical subexpressions are shared, i.e., the same node may
+ * be the child of several parents. Ids are dense and assigned in post-order:
+ * every node reachable from the root has an id in [1, root->id] and a
+ * larger id than its children. The nodes are stored contiguously in id
+ * order, so the node with id i is at root + (i - root->id).
+ */
+
 struct parser;
 
 struct parser *parser_open(const char *s);
 
+/**
+ * Same as parser_open(), but the expression is the content of the file at
+ * pathname. The file is mapped rather than read, and tokenized as the
+ * parser goes, so expressions of any size are parsed without a copy.
+ */
+
+struct parser *parser_load(const char *pathname);
+
 void parser_close(struct parser *parser);
 
 const struct parser_dag *parser_dag(const struct parser *parser);
 
+/**
+ * Returns the number of named variables in the expression. Backends receive
+ * their values as an array x, with x[i] the value of parser_var(parser, i).
+ */
+
+int parser_vars(const struct parser *parser);
+
+/**
+ * Returns the name of variable i, 0 <= i < parser_vars(parser). Variables
+ * are numbered in order of first appearance.
+ */
+
+const char *parser_var(const struct parser *parser, int i);
+
+/**
+ * Lists each distinct node of dag exactly once, children before parents.
+ *
+ * dag  : the expression previously obtained by calling parser_dag()
+ * order: receives dag->id entries; order[i] is the node with id i + 1
+ */
+
+void parser_order(const struct parser_dag *dag,
+		  const struct parser_dag **order);
+
 #endif /* _PARSER_H_ */
@@ -0,0 +1,239 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * policy.c
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/stat.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <math.h>
+#include "policy.h"
+
+/**
+ * Needs:
+ *   pthread_mutex_lock()
+ *   pthread_mutex_unlock()
+ *   mkstemp()
+ *   rename()
+ */
+
+#define RATE 0.5 /* how far each sample moves the model, in log space */
+#define CLAMP 8.0 /* no single sample moves the model by more than this */
+#define MIN_SAMPLE 1e6 /* ns, shorter evaluation runs are mostly noise */
+
+struct cost {
+	double base;              /* ns */
+	double compile_per_node;  /* ns */
+	double evaluate_per_node; /* ns */
+};
+
+/* defaults, measured with bench/bench (left-deep shape, 40 to 3000 nodes) */
+
+static const struct cost DEFAULTS[JITC_END] = {
+	{ 20e6,  39e3, 2.2 },
+	{ 23e6,  80e3, 0.5 },
+	{ 27e6, 110e3, 0.5 },
+	{ 35e6, 213e3, 0.5 }
+};
+
+struct policy {
+	char *pathname;
+	pthread_mutex_t mutex;
+	struct cost cost[JITC_END];
+};
+
+/**
+ * Returns f raised to RATE * w, with f clamped to [1/CLAMP, CLAMP].
+ */
+
+static double
+step(double f, double w)
+{
+	if (!(f == f) || (0.0 >= f)) {
+		return 1.0;
+	}
+	f = MIN(MAX(f, 1.0 / CLAMP), CLAMP);
+	return pow(f, RATE * w);
+}
+
+static void
+load(struct policy *policy)
+{
+	struct cost cost[JITC_END];
+	FILE *file;
+	int i, level;
+
+	if (!(file = fopen(policy->pathname, "r"))) {
+		return; /* first run, keep the defaults */
+	}
+	for (i=0; i<JITC_END; ++i) {
+		if ((4 != fscanf(file,
+				 "O%d %lf %lf %lf\n",
+				 &level,
+				 &cost[i].base,
+				 &cost[i].compile_per_node,
+				 &cost[i].evaluate_per_node)) ||
+		    (level != i) ||
+		    !(0.0 < cost[i].base) ||
+		    !(0.0 < cost[i].compile_per_node) ||
+		    !(0.0 < cost[i].evaluate_per_node)) {
+			fclose(file);
+			TRACE("ignoring malformed policy file");
+			return;
+		}
+	}
+	fclose(file);
+	memcpy(policy->cost, cost, sizeof (cost));
+}
+
+static void
+save(struct policy *policy)
+{
+	char tmp[1024];
+	FILE *file;
+	int i, fd;
+
+	/* a temporary of its own, processes may be saving concurrently */
+
+	safe_sprintf(tmp, sizeof (tmp), "%s.XXXXXX", policy->pathname);
+	if (0 > (fd = mkstemp(tmp))) {
+		TRACE("mkstemp()");
+		return;
+	}
+	if (fchmod(fd, 0644) || !(file = fdopen(fd, "w"))) {
+		close(fd);
+		file_delete(tmp);
+		TRACE("fdopen()");
+		return;
+	}
+	for (i=0; i<JITC_END; ++i) {
+		fprintf(file,
+			"O%d %.6g %.6g %.6g\n",
+			i,
+			policy->cost[i].base,
+			policy->cost[i].compile_per_node,
+			policy->cost[i].evaluate_per_node);
+	}
+	if (fclose(file) || rename(tmp, policy->pathname)) {
+		file_delete(tmp);
+		TRACE("unable to save policy");
+	}
+}
+
+struct policy *
+policy_open(const char *pathname)
+{
+	struct policy *policy;
+	size_t n;
+
+	assert( safe_strlen(pathname) );
+
+	if (!(policy = malloc(sizeof (struct policy)))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(policy, 0, sizeof (struct policy));
+	n = safe_strlen(pathname) + 1;
+	if (!(policy->pathname = malloc(n))) {
+		FREE(policy);
+		TRACE("out of memory");
+		return NULL;
+	}
+	memcpy(policy->pathname, pathname, n);
+	pthread_mutex_init(&policy->mutex, NULL);
+	memcpy(policy->cost, DEFAULTS, sizeof (DEFAULTS));
+	load(policy);
+	return policy;
+}
+
+void
+policy_close(struct policy *policy)
+{
+	if (policy) {
+		save(policy);
+		pthread_mutex_destroy(&policy->mutex);
+		FREE(policy->pathname);
+		memset(policy, 0, sizeof (struct policy));
+	}
+	FREE(policy);
+}
+
+enum jitc_level
+policy_level(struct policy *policy, int nodes, uint64_t evaluations)
+{
+	const struct cost *cost;
+	double total, best;
+	int i, level;
+
+	assert( policy );
+	assert( 0 < nodes );
+
+	pthread_mutex_lock(&policy->mutex);
+	level = JITC_O3;
+	best = 0.0;
+	for (i=0; i<JITC_END; ++i) {
+		cost = &policy->cost[i];
+		total = cost->base +
+			cost->compile_per_node * nodes +
+			cost->evaluate_per_node * nodes * (double)evaluations;
+		if (!i || (total < best)) {
+			best = total;
+			level = i;
+		}
+	}
+	pthread_mutex_unlock(&policy->mutex);
+	return (enum jitc_level)level;
+}
+
+void
+policy_compiled(struct policy *policy,
+		enum jitc_level level,
+		int nodes,
+		uint64_t ns)
+{
+	struct cost *cost;
+	double model, w, f;
+
+	assert( policy );
+	assert( level < JITC_END );
+
+	/* credit the error to the two terms in proportion to their share */
+
+	pthread_mutex_lock(&policy->mutex);
+	cost = &policy->cost[level];
+	model = cost->base + cost->compile_per_node * nodes;
+	w = (cost->compile_per_node * nodes) / model;
+	f = (double)ns / model;
+	cost->compile_per_node *= step(f, w);
+	cost->base *= step(f, 1.0 - w);
+	pthread_mutex_unlock(&policy->mutex);
+}
+
+void
+policy_evaluated(struct policy *policy,
+		 enum jitc_level level,
+		 int nodes,
+		 uint64_t evaluations,
+		 uint64_t ns)
+{
+	struct cost *cost;
+	double model;
+
+	assert( policy );
+	assert( level < JITC_END );
+
+	if (!evaluations || (0 >= nodes) || (MIN_SAMPLE > (double)ns)) {
+		return;
+	}
+	pthread_mutex_lock(&policy->mutex);
+	cost = &policy->cost[level];
+	model = cost->evaluate_per_node * nodes * (double)evaluations;
+	cost->evaluate_per_node *= step((double)ns / model, 1.0);
+	pthread_mutex_unlock(&policy->mutex);
+}
@@ -0,0 +1,80 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * policy.h
+ */
+
+#ifndef _POLICY_H_
+#define _POLICY_H_
+
+#include "system.h"
+#include "jitc.h"
+
+/**
+ * Picks the gcc optimization level that minimizes end-to-end latency, i.e.,
+ * compile time plus evaluation time over the expected number of
+ * evaluations. The cost model per level is
+ *
+ *   compile  = base + nodes * compile_per_node
+ *   evaluate = nodes * evaluate_per_node        (per evaluation)
+ *
+ * seeded with defaults and calibrated from the timings reported through
+ * policy_compiled() and policy_evaluated(). The calibration is saved, so
+ * it carries over between runs. A policy may be shared between threads.
+ */
+
+struct policy;
+
+/**
+ * Opens a policy, loading the calibration saved at pathname, if any.
+ *
+ * pathname: the file holding the calibration
+ *
+ * return: an opaque handle or NULL on error
+ */
+
+struct policy *policy_open(const char *pathname);
+
+/**
+ * Saves the calibration and closes the policy.
+ *
+ * policy: an opaque handle previously obtained by calling policy_open()
+ *
+ * Note: policy may be NULL.
+ */
+
+void policy_close(struct policy *policy);
+
+/**
+ * Returns the cheapest level for compiling an expression of nodes nodes
+ * that is expected to be evaluated evaluations times.
+ */
+
+enum jitc_level policy_level(struct policy *policy,
+			     int nodes,
+			     uint64_t evaluations);
+
+/**
+ * Records that compiling nodes nodes at level took ns nanoseconds.
+ */
+
+void policy_compiled(struct policy *policy,
+		     enum jitc_level level,
+		     int nodes,
+		     uint64_t ns);
+
+/**
+ * Records that evaluations evaluations of nodes nodes compiled at level took
+ * ns nanoseconds in total.
+ */
+
+void policy_evaluated(struct policy *policy,
+		      enum jitc_level level,
+		      int nodes,
+		      uint64_t evaluations,
+		      uint64_t ns);
+
+#endif /* _POLICY_H_ */
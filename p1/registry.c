@@ -0,0 +1,406 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * registry.c
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sched.h>
+#include "jitc.h"
+#include "registry.h"
+
+/**
+ * Needs:
+ *   pthread_mutex_lock()
+ *   sched_yield()
+ *   stat()
+ */
+
+/**
+ * Reclamation. A module holds one reference for the registry while it is
+ * published and one per reader. Readers take theirs inside an epoch: they
+ * count themselves in active[epoch & 1] around loading the pointer and
+ * incrementing the count, and start over if the epoch moved on before they
+ * were counted, since a writer may already have found that parity drained
+ * (and another writer only waits on the next one). A writer that
+ * unpublishes a module flips the epoch and waits for the previous parity to
+ * drain (a few instructions per reader), after which no reader can reach
+ * the module anymore; only then does it drop the registry's reference.
+ * Whoever drops the last reference pushes the module on the released list,
+ * and writers dlclose() it later, so readers never unload a module
+ * themselves.
+ */
+
+struct registry_module {
+	struct jitc *jitc;
+	uint64_t size; /* of the module file */
+	uint64_t used; /* tick of the last acquisition */
+	int refs;
+	struct registry_module *next; /* released list */
+};
+
+struct entry {
+	uint64_t hash;
+	char *name;
+	struct registry_module *module; /* published, NULL if evicted */
+};
+
+struct registry {
+	pthread_mutex_t mutex; /* writers */
+	uint64_t budget;
+	uint64_t total; /* size of the published modules */
+	uint64_t tick; /* advanced by every publication */
+	uint64_t epoch;
+	uint64_t active[2]; /* readers acquiring, by epoch parity */
+	struct registry_module *released; /* awaiting dlclose() */
+	int capacity; /* names */
+	int n;
+	uint64_t size; /* slots, a power of two */
+	struct entry **entries; /* open addressing, insert only */
+};
+
+static uint64_t
+hash(const char *name)
+{
+	uint64_t h;
+
+	h = 0xcbf29ce484222325;
+	while (*name) {
+		h ^= (unsigned char)(*name++);
+		h *= 0x100000001b3;
+	}
+	return h;
+}
+
+/**
+ * Returns the entry of name, or NULL. Lock-free: entries are published
+ * fully initialized and never move.
+ */
+
+static struct entry *
+find(const struct registry *registry, const char *name, uint64_t h)
+{
+	struct entry *entry;
+	uint64_t i;
+
+	for (i=h; ; ++i) {
+		entry = __atomic_load_n(&registry->entries[i & (registry->size - 1)],
+					__ATOMIC_ACQUIRE);
+		if (!entry) {
+			return NULL;
+		}
+		if ((h == entry->hash) && !strcmp(name, entry->name)) {
+			return entry;
+		}
+	}
+}
+
+static struct entry *
+insert(struct registry *registry, const char *name, uint64_t h)
+{
+	struct entry *entry;
+	size_t len;
+	uint64_t i;
+
+	if (registry->n == registry->capacity) {
+		TRACE("registry full");
+		return NULL;
+	}
+	len = safe_strlen(name) + 1;
+	if (!(entry = malloc(sizeof (struct entry))) ||
+	    !(entry->name = malloc(len))) {
+		FREE(entry);
+		TRACE("out of memory");
+		return NULL;
+	}
+	memcpy(entry->name, name, len);
+	entry->hash = h;
+	entry->module = NULL;
+	for (i=h; registry->entries[i & (registry->size - 1)]; ++i) {
+	}
+	__atomic_store_n(&registry->entries[i & (registry->size - 1)],
+			 entry,
+			 __ATOMIC_RELEASE);
+	++registry->n;
+	return entry;
+}
+
+static void
+release(struct registry *registry, struct registry_module *module)
+{
+	if (!__atomic_sub_fetch(&module->refs, 1, __ATOMIC_ACQ_REL)) {
+		module->next = __atomic_load_n(&registry->released,
+					       __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&registry->released,
+						    &module->next,
+						    module,
+						    1,
+						    __ATOMIC_RELEASE,
+						    __ATOMIC_RELAXED)) {
+		}
+	}
+}
+
+/**
+ * Unloads the released modules. Called with the writer mutex held (or
+ * from registry_close()).
+ */
+
+static void
+collect(struct registry *registry)
+{
+	struct registry_module *module, *next;
+
+	module = __atomic_exchange_n(&registry->released, NULL, __ATOMIC_ACQUIRE);
+	while (module) {
+		next = module->next;
+		jitc_close(module->jitc);
+		memset(module, 0, sizeof (struct registry_module));
+		FREE(module);
+		module = next;
+	}
+}
+
+/**
+ * Waits until every reader that may have loaded a pointer before it was
+ * swapped has incremented the module's count, or given up.
+ */
+
+static void
+synchronize(struct registry *registry)
+{
+	uint64_t epoch;
+
+	epoch = __atomic_fetch_add(&registry->epoch, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&registry->active[epoch & 1], __ATOMIC_SEQ_CST)) {
+		sched_yield();
+	}
+}
+
+/**
+ * Unpublishes the least recently acquired modules, other than keep, until
+ * the published modules fit the budget. Returns them, linked by next.
+ */
+
+static struct registry_module *
+evict(struct registry *registry, const struct registry_module *keep)
+{
+	struct registry_module *module, *evicted;
+	struct entry *entry, *lru;
+	uint64_t i;
+
+	evicted = NULL;
+	while (registry->total > registry->budget) {
+		lru = NULL;
+		for (i=0; i<registry->size; ++i) {
+			if ((entry = registry->entries[i]) &&
+			    (module = entry->module) &&
+			    (module != keep) &&
+			    (!lru ||
+			     (__atomic_load_n(&module->used, __ATOMIC_RELAXED) <
+			      __atomic_load_n(&lru->module->used,
+					      __ATOMIC_RELAXED)))) {
+				lru = entry;
+			}
+		}
+		if (!lru) {
+			break; /* keep alone is over budget */
+		}
+		module = __atomic_exchange_n(&lru->module, NULL, __ATOMIC_SEQ_CST);
+		registry->total -= module->size;
+		module->next = evicted;
+		evicted = module;
+	}
+	return evicted;
+}
+
+struct registry *
+registry_open(int capacity, uint64_t budget)
+{
+	struct registry *registry;
+
+	assert( 0 < capacity );
+
+	if (!(registry = malloc(sizeof (struct registry)))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(registry, 0, sizeof (struct registry));
+	registry->capacity = capacity;
+	registry->budget = budget;
+	registry->size = 2;
+	while (registry->size < 2 * (uint64_t)capacity) {
+		registry->size *= 2;
+	}
+	if (!(registry->entries = malloc(registry->size *
+					 sizeof (registry->entries[0])))) {
+		FREE(registry);
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(registry->entries, 0, registry->size * sizeof (registry->entries[0]));
+	pthread_mutex_init(&registry->mutex, NULL);
+	return registry;
+}
+
+void
+registry_close(struct registry *registry)
+{
+	struct entry *entry;
+	uint64_t i;
+
+	if (registry) {
+		for (i=0; i<registry->size; ++i) {
+			if ((entry = registry->entries[i])) {
+				if (entry->module) {
+					release(registry, entry->module);
+				}
+				FREE(entry->name);
+				FREE(entry);
+			}
+		}
+		collect(registry);
+		pthread_mutex_destroy(&registry->mutex);
+		FREE(registry->entries);
+		memset(registry, 0, sizeof (struct registry));
+	}
+	FREE(registry);
+}
+
+int
+registry_publish(struct registry *registry,
+		 const char *name,
+		 const char *pathname)
+{
+	struct registry_module *module, *old, *next;
+	struct entry *entry;
+	struct stat st;
+	uint64_t h;
+
+	assert( registry );
+	assert( safe_strlen(name) );
+	assert( safe_strlen(pathname) );
+
+	/* load outside of the lock, dlopen() may take a while */
+
+	if (stat(pathname, &st)) {
+		TRACE("stat()");
+		return -1;
+	}
+	if (!(module = malloc(sizeof (struct registry_module)))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	memset(module, 0, sizeof (struct registry_module));
+	if (!(module->jitc = jitc_open(pathname))) {
+		FREE(module);
+		TRACE(0);
+		return -1;
+	}
+	module->size = (uint64_t)st.st_size;
+	module->refs = 1;
+
+	/* swap it in, then reclaim what it replaced and what no longer fits */
+
+	h = hash(name);
+	pthread_mutex_lock(&registry->mutex);
+	if (!(entry = find(registry, name, h)) &&
+	    !(entry = insert(registry, name, h))) {
+		pthread_mutex_unlock(&registry->mutex);
+		jitc_close(module->jitc);
+		FREE(module);
+		TRACE(0);
+		return -1;
+	}
+	module->used = __atomic_add_fetch(&registry->tick, 1, __ATOMIC_RELAXED);
+	old = __atomic_exchange_n(&entry->module, module, __ATOMIC_SEQ_CST);
+	registry->total += module->size;
+	if (old) {
+		registry->total -= old->size;
+		old->next = NULL;
+	}
+	if ((next = evict(registry, module))) {
+		if (old) {
+			old->next = next;
+		}
+		else {
+			old = next;
+		}
+	}
+	if (old) {
+		synchronize(registry);
+	}
+	while (old) {
+		next = old->next;
+		release(registry, old);
+		old = next;
+	}
+	collect(registry);
+	pthread_mutex_unlock(&registry->mutex);
+	return 0;
+}
+
+struct registry_module *
+registry_acquire(struct registry *registry, const char *name)
+{
+	struct registry_module *module;
+	struct entry *entry;
+	uint64_t epoch, tick;
+
+	assert( registry );
+	assert( safe_strlen(name) );
+
+	if (!(entry = find(registry, name, hash(name)))) {
+		return NULL;
+	}
+	for (;;) {
+		epoch = __atomic_load_n(&registry->epoch, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&registry->active[epoch & 1],
+				   1,
+				   __ATOMIC_SEQ_CST);
+		if (epoch == __atomic_load_n(&registry->epoch, __ATOMIC_SEQ_CST)) {
+			break;
+		}
+		__atomic_sub_fetch(&registry->active[epoch & 1],
+				   1,
+				   __ATOMIC_RELEASE);
+	}
+	if ((module = __atomic_load_n(&entry->module, __ATOMIC_SEQ_CST))) {
+		__atomic_add_fetch(&module->refs, 1, __ATOMIC_RELAXED);
+	}
+	__atomic_sub_fetch(&registry->active[epoch & 1], 1, __ATOMIC_RELEASE);
+
+	/* recency, written only when it changes to spare the cache line */
+
+	if (module) {
+		tick = __atomic_load_n(&registry->tick, __ATOMIC_RELAXED);
+		if (tick != __atomic_load_n(&module->used, __ATOMIC_RELAXED)) {
+			__atomic_store_n(&module->used, tick, __ATOMIC_RELAXED);
+		}
+	}
+	return module;
+}
+
+void
+registry_release(struct registry *registry, struct registry_module *module)
+{
+	assert( registry );
+	assert( module );
+
+	release(registry, module);
+}
+
+long
+registry_lookup(struct registry_module *module, const char *symbol)
+{
+	assert( module );
+
+	return jitc_lookup(module->jitc, symbol);
+}
@@ -0,0 +1,103 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * registry.h
+ */
+
+#ifndef _REGISTRY_H_
+#define _REGISTRY_H_
+
+#include "system.h"
+
+/**
+ * A registry of loaded modules by name, for replacing expressions while
+ * other threads evaluate them. Readers never block: registry_acquire() is
+ * a hash probe, an atomic load and a reference count increment. Writers
+ * (registry_publish() and eviction) swap the module pointer atomically and
+ * hand the old module to deferred reclamation: it is unloaded once no
+ * reader can still be acquiring it (an epoch grace period) and its last
+ * reference has been released.
+ */
+
+struct registry;
+struct registry_module;
+
+/**
+ * Opens an empty registry.
+ *
+ * capacity: the maximum number of distinct names
+ * budget  : the maximum total size, in bytes, of the loaded modules; the
+ *           least recently acquired ones are evicted beyond it
+ *
+ * return: an opaque handle or NULL on error
+ */
+
+struct registry *registry_open(int capacity, uint64_t budget);
+
+/**
+ * Closes a previously opened registry, unloading every module. No module
+ * may be held, i.e., acquired and not yet released.
+ *
+ * registry: an opaque handle previously obtained by calling registry_open()
+ *
+ * Note: registry may be NULL.
+ */
+
+void registry_close(struct registry *registry);
+
+/**
+ * Loads the module at pathname and publishes it under name, replacing the
+ * previous one, if any. Evaluations that acquired the previous module keep
+ * running it until they release it. May be called concurrently with every
+ * other function but registry_close().
+ *
+ * registry: an opaque handle previously obtained by calling registry_open()
+ * name    : the name of the expression
+ * pathname: the file pathname of a module, see jitc_compile()
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int registry_publish(struct registry *registry,
+		     const char *name,
+		     const char *pathname);
+
+/**
+ * Returns the module currently published under name, which stays loaded
+ * until released. Lock-free.
+ *
+ * registry: an opaque handle previously obtained by calling registry_open()
+ * name    : the name of the expression
+ *
+ * return: the module, or NULL if nothing is published under name (or it
+ *         was evicted, in which case it must be published again)
+ */
+
+struct registry_module *registry_acquire(struct registry *registry,
+					 const char *name);
+
+/**
+ * Releases a module previously obtained by calling registry_acquire().
+ *
+ * registry: an opaque handle previously obtained by calling registry_open()
+ * module  : the module
+ */
+
+void registry_release(struct registry *registry,
+		      struct registry_module *module);
+
+/**
+ * Searches for a symbol in an acquired module.
+ *
+ * module: a module previously obtained by calling registry_acquire()
+ * symbol: the name of the symbol, e.g. "evaluate"
+ *
+ * return: the memory address of the start of the symbol, or 0 on error
+ */
+
+long registry_lookup(struct registry_module *module, const char *symbol);
+
+#endif /* _REGISTRY_H_ */
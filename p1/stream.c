@@ -0,0 +1,594 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * stream.c
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "stream.h"
+
+/**
+ * Needs:
+ *   fstat()
+ *   mmap()
+ *   madvise()
+ *   read()
+ *   write()
+ */
+
+#define BLOCK 1024 /* rows per evaluate_batch() */
+#define INPUT (1024 * 1024) /* bytes read at a time, also the longest line */
+#define OUTPUT (256 * 1024) /* bytes of results buffered */
+#define FORMATTED 16 /* bytes of a formatted result, at most */
+#define TOKEN 64 /* bytes of a number handed to strtod(), at most */
+
+#define DIGIT(c) ( ((c) >= '0') && ((c) <= '9') )
+#define BLANK(c) ( (' ' == (c)) || ('\t' == (c)) || ('\r' == (c)) )
+
+struct stream {
+	const struct parser *parser;
+	evaluate_batch_t fnc;
+	int nvars;
+	int ncols; /* STREAM_CSV: columns per row, 0 until the header */
+	int *map; /* STREAM_CSV: the variable of each column, or -1 */
+	double **cols; /* nvars columns of BLOCK rows */
+	double *out; /* BLOCK results */
+	size_t n; /* rows in the block */
+	uint64_t line; /* STREAM_CSV: the current line, for errors */
+	uint64_t rows;
+	enum stream_format format;
+	int fd; /* output */
+	char *buf; /* OUTPUT bytes */
+	size_t len; /* bytes in buf */
+};
+
+/**
+ * The powers of ten a double holds exactly.
+ */
+
+static const double POW10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/**
+ * Parses a decimal number at p, not beyond end, into val. With at most 15
+ * significant digits and an exponent of at most 22 in magnitude, both the
+ * digits and the power of ten are exact, so one multiplication or division
+ * is correctly rounded. Anything else (rare in practice) is left to
+ * strtod().
+ *
+ * return: the end of the number, or NULL if there is none
+ */
+
+static const char *
+number(const char *p, const char *end, double *val)
+{
+	char buf[TOKEN];
+	const char *s;
+	int digits, any, neg, exp, e, eneg;
+	uint64_t m;
+
+	s = p;
+	neg = 0;
+	if ((p < end) && (('-' == *p) || ('+' == *p))) {
+		neg = ('-' == *p);
+		++p;
+	}
+	m = 0;
+	digits = 0; /* significant, i.e., after leading zeros */
+	any = 0;
+	exp = 0;
+	for (; (p < end) && DIGIT(*p); ++p) {
+		any = 1;
+		if (19 > digits) {
+			m = m * 10 + (uint64_t)(*p - '0');
+			digits += !!m;
+		}
+		else {
+			++exp;
+		}
+	}
+	if ((p < end) && ('.' == *p)) {
+		for (++p; (p < end) && DIGIT(*p); ++p) {
+			any = 1;
+			if (19 > digits) {
+				m = m * 10 + (uint64_t)(*p - '0');
+				digits += !!m;
+				--exp;
+			}
+		}
+	}
+	if (!any) {
+		return NULL;
+	}
+	if ((p < end) && (('e' == *p) || ('E' == *p))) {
+		eneg = 0;
+		if ((++p < end) && (('-' == *p) || ('+' == *p))) {
+			eneg = ('-' == *p);
+			++p;
+		}
+		if ((p >= end) || !DIGIT(*p)) {
+			return NULL;
+		}
+		for (e=0; (p < end) && DIGIT(*p); ++p) {
+			e = (10000 > e) ? (e * 10 + (*p - '0')) : e;
+		}
+		exp += eneg ? -e : e;
+	}
+	if (!m) {
+		*val = neg ? -0.0 : 0.0;
+		return p;
+	}
+	if ((15 >= digits) && (-22 <= exp) && (22 >= exp)) {
+		*val = (0 <= exp) ?
+			((double)m * POW10[exp]) :
+			((double)m / POW10[-exp]);
+		*val = neg ? -*val : *val;
+		return p;
+	}
+	if ((size_t)(p - s) >= sizeof (buf)) {
+		return NULL;
+	}
+	memcpy(buf, s, (size_t)(p - s));
+	buf[p - s] = 0;
+	*val = strtod(buf, NULL);
+	return p;
+}
+
+/**
+ * Formats r as printf("%f\n") would, without printf(). Results are those of
+ * the logistic sigmoid, i.e., in [0, 1] or NaN.
+ *
+ * return: the number of bytes written to s, at most FORMATTED
+ */
+
+static size_t
+format(double r, char *s)
+{
+	uint64_t u;
+	int i;
+
+	if (!((0.0 <= r) && (1.0 >= r))) {
+		memcpy(s, "nan\n", 4);
+		return 4;
+	}
+	u = (uint64_t)(r * 1e6 + 0.5);
+	s[0] = (char)('0' + (u / 1000000));
+	s[1] = '.';
+	u %= 1000000;
+	for (i=7; i>1; --i) {
+		s[i] = (char)('0' + (u % 10));
+		u /= 10;
+	}
+	s[8] = '\n';
+	return 9;
+}
+
+static int
+drain(struct stream *stream)
+{
+	ssize_t r;
+	size_t k;
+
+	for (k=0; k<stream->len; k+=(size_t)r) {
+		if (0 > (r = write(stream->fd,
+				   stream->buf + k,
+				   stream->len - k))) {
+			if (EINTR == errno) {
+				r = 0;
+				continue;
+			}
+			TRACE("write()");
+			return -1;
+		}
+	}
+	stream->len = 0;
+	return 0;
+}
+
+/**
+ * Evaluates the rows gathered so far and buffers their results.
+ */
+
+static int
+flush(struct stream *stream)
+{
+	size_t i, n;
+
+	if (!stream->n) {
+		return 0;
+	}
+	stream->fnc((const double *const *)stream->cols,
+		    stream->n,
+		    stream->out);
+	if (STREAM_CSV == stream->format) {
+		for (i=0; i<stream->n; ++i) {
+			if (((OUTPUT - stream->len) < FORMATTED) &&
+			    drain(stream)) {
+				TRACE(0);
+				return -1;
+			}
+			stream->len += format(stream->out[i],
+					      stream->buf + stream->len);
+		}
+	}
+	else {
+		for (i=0; i<stream->n; i+=n) {
+			if (((OUTPUT - stream->len) < sizeof (double)) &&
+			    drain(stream)) {
+				TRACE(0);
+				return -1;
+			}
+			n = MIN(stream->n - i,
+				(OUTPUT - stream->len) / sizeof (double));
+			memcpy(stream->buf + stream->len,
+			       stream->out + i,
+			       n * sizeof (double));
+			stream->len += n * sizeof (double);
+		}
+	}
+	stream->rows += stream->n;
+	stream->n = 0;
+	return 0;
+}
+
+/**
+ * Maps the columns named by the header line [p, end) to variables.
+ */
+
+static int
+header(struct stream *stream, const char *p, const char *end)
+{
+	const char *s, *name;
+	size_t len;
+	int i, j;
+
+	stream->ncols = 1;
+	for (s=p; s<end; ++s) {
+		stream->ncols += (',' == *s);
+	}
+	if (!(stream->map = malloc(stream->ncols * sizeof (stream->map[0])))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	for (j=0; j<stream->ncols; ++j) {
+		while ((p < end) && BLANK(*p)) {
+			++p;
+		}
+		for (s=p; (p < end) && (',' != *p); ++p) {
+		}
+		for (len=(size_t)(p - s); len && BLANK(s[len - 1]); --len) {
+		}
+		stream->map[j] = -1;
+		for (i=0; i<stream->nvars; ++i) {
+			name = parser_var(stream->parser, i);
+			if ((safe_strlen(name) == len) && !memcmp(name, s, len)) {
+				stream->map[j] = i;
+			}
+		}
+		++p; /* ',' */
+	}
+	for (i=0; i<stream->nvars; ++i) {
+		for (j=0; (j<stream->ncols) && (i != stream->map[j]); ++j) {
+		}
+		if (j == stream->ncols) {
+			fprintf(stderr,
+				"error: variable '%s' is not a column\n",
+				parser_var(stream->parser, i));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Gathers the row [p, end) into the block, skipping the columns that are
+ * not variables without parsing them.
+ */
+
+static int
+row(struct stream *stream, const char *p, const char *end)
+{
+	double val;
+	int j, var;
+
+	for (j=0; j<stream->ncols; ++j) {
+		if (0 > (var = stream->map[j])) {
+			while ((p < end) && (',' != *p)) {
+				++p;
+			}
+		}
+		else {
+			while ((p < end) && BLANK(*p)) {
+				++p;
+			}
+			if (!(p = number(p, end, &val))) {
+				break;
+			}
+			stream->cols[var][stream->n] = val;
+			while ((p < end) && BLANK(*p)) {
+				++p;
+			}
+		}
+		if ((j + 1) < stream->ncols) {
+			if ((p >= end) || (',' != *p)) {
+				break;
+			}
+			++p;
+		}
+	}
+	if ((j < stream->ncols) || (p != end)) {
+		fprintf(stderr,
+			"error: line %lu: expecting %d columns\n",
+			(unsigned long)stream->line,
+			stream->ncols);
+		return -1;
+	}
+	if (BLOCK == ++stream->n) {
+		return flush(stream);
+	}
+	return 0;
+}
+
+/**
+ * Consumes the complete lines of [p, p + len), or every line if eof is set.
+ *
+ * used: receives the number of bytes consumed
+ */
+
+static int
+csv(struct stream *stream, const char *p, size_t len, int eof, size_t *used)
+{
+	const char *s, *q, *end;
+	int e;
+
+	end = p + len;
+	for (s=p; s<end; s=q+1) {
+		if (!(q = memchr(s, '\n', (size_t)(end - s)))) {
+			if (!eof) {
+				break;
+			}
+			q = end;
+		}
+		++stream->line;
+		e = 0;
+		while ((s < q) && BLANK(*s)) {
+			++s;
+		}
+		if (s == q) {
+			/* blank line */
+		}
+		else if (!stream->ncols) {
+			e = header(stream, s, q);
+		}
+		else {
+			e = row(stream, s, q);
+		}
+		if (e) {
+			TRACE(0);
+			return -1;
+		}
+	}
+	*used = (size_t)(MIN(s, end) - p);
+	return 0;
+}
+
+/**
+ * Consumes the complete rows of [p, p + len); eof leaves no partial row.
+ *
+ * used: receives the number of bytes consumed
+ */
+
+static int
+binary(struct stream *stream,
+       const char *p,
+       size_t len,
+       int eof,
+       size_t *used)
+{
+	size_t width, rows, k;
+	int i;
+
+	width = stream->nvars * sizeof (double);
+	rows = len / width;
+	for (k=0; k<rows; ++k, p+=width) {
+		for (i=0; i<stream->nvars; ++i) {
+			memcpy(&stream->cols[i][stream->n],
+			       p + i * sizeof (double),
+			       sizeof (double));
+		}
+		if ((BLOCK == ++stream->n) && flush(stream)) {
+			TRACE(0);
+			return -1;
+		}
+	}
+	*used = rows * width;
+	if (eof && (len % width)) {
+		fprintf(stderr, "error: truncated row at end of input\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int (* const CONSUME[])(struct stream *,
+			       const char *,
+			       size_t,
+			       int,
+			       size_t *) = {
+	csv,
+	binary
+};
+
+static void
+stream_close(struct stream *stream)
+{
+	if (stream) {
+		if (stream->cols) {
+			FREE(stream->cols[0]);
+		}
+		FREE(stream->cols);
+		FREE(stream->map);
+		FREE(stream->out);
+		FREE(stream->buf);
+		memset(stream, 0, sizeof (struct stream));
+	}
+	FREE(stream);
+}
+
+static struct stream *
+stream_open(const struct parser *parser,
+	    evaluate_batch_t fnc,
+	    enum stream_format format,
+	    int out)
+{
+	struct stream *stream;
+	int i;
+
+	if (!(stream = malloc(sizeof (struct stream)))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(stream, 0, sizeof (struct stream));
+	stream->parser = parser;
+	stream->fnc = fnc;
+	stream->nvars = parser_vars(parser);
+	stream->format = format;
+	stream->fd = out;
+	if ((STREAM_BINARY == format) && !stream->nvars) {
+		stream_close(stream);
+		fprintf(stderr, "error: binary rows need at least one variable\n");
+		return NULL;
+	}
+	if (!(stream->cols = malloc((stream->nvars + 1) *
+				    sizeof (stream->cols[0]))) ||
+	    !(stream->cols[0] = malloc((stream->nvars + 1) *
+				       BLOCK *
+				       sizeof (stream->cols[0][0]))) ||
+	    !(stream->out = malloc(BLOCK * sizeof (stream->out[0]))) ||
+	    !(stream->buf = malloc(OUTPUT))) {
+		stream_close(stream);
+		TRACE("out of memory");
+		return NULL;
+	}
+	for (i=1; i<stream->nvars; ++i) {
+		stream->cols[i] = stream->cols[0] + (size_t)i * BLOCK;
+	}
+	return stream;
+}
+
+/**
+ * Feeds a stream that cannot be mapped (e.g. a pipe) to CONSUME, INPUT
+ * bytes at a time, carrying partial rows over.
+ */
+
+static int
+feed(struct stream *stream, int in, uint64_t *bytes)
+{
+	size_t len, used;
+	ssize_t r;
+	char *buf;
+	int e;
+
+	if (!(buf = malloc(INPUT))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	e = 0;
+	len = 0;
+	for (;;) {
+		if (0 > (r = read(in, buf + len, INPUT - len))) {
+			if (EINTR == errno) {
+				continue;
+			}
+			TRACE("read()");
+			e = -1;
+			break;
+		}
+		len += (size_t)r;
+		*bytes += (uint64_t)r;
+		if (CONSUME[stream->format](stream, buf, len, !r, &used)) {
+			TRACE(0);
+			e = -1;
+			break;
+		}
+		memmove(buf, buf + used, len - used);
+		len -= used;
+		if (!r) {
+			break;
+		}
+		if (INPUT == len) {
+			TRACE("line too long");
+			e = -1;
+			break;
+		}
+	}
+	FREE(buf);
+	return e;
+}
+
+int
+stream_evaluate(const struct parser *parser,
+		evaluate_batch_t fnc,
+		enum stream_format format,
+		int in,
+		int out,
+		struct stream_stats *stats)
+{
+	struct stream *stream;
+	uint64_t t, bytes;
+	struct stat st;
+	size_t used;
+	void *p;
+	int e;
+
+	assert( parser );
+	assert( fnc );
+
+	t = ns_time();
+	if (!(stream = stream_open(parser, fnc, format, out))) {
+		TRACE(0);
+		return -1;
+	}
+	bytes = 0;
+	if (!fstat(in, &st) && S_ISREG(st.st_mode) && st.st_size) {
+		bytes = (uint64_t)st.st_size;
+		p = mmap(NULL, (size_t)bytes, PROT_READ, MAP_PRIVATE, in, 0);
+		if (MAP_FAILED == p) {
+			stream_close(stream);
+			TRACE("mmap()");
+			return -1;
+		}
+		if (madvise(p, (size_t)bytes, MADV_SEQUENTIAL)) {
+			/* ignore */
+		}
+		e = CONSUME[format](stream, p, (size_t)bytes, 1, &used);
+		munmap(p, (size_t)bytes);
+	}
+	else {
+		e = feed(stream, in, &bytes);
+	}
+	/* even after a bad row, the rows accepted before it are written */
+
+	if (flush(stream) || drain(stream)) {
+		e = -1;
+	}
+	if (stats) {
+		stats->rows = stream->rows;
+		stats->bytes = bytes;
+		stats->ns = ns_time() - t;
+	}
+	stream_close(stream);
+	if (e) {
+		TRACE(0);
+		return -1;
+	}
+	return 0;
+}
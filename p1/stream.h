@@ -0,0 +1,62 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * stream.h
+ */
+
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+#include "codegen.h"
+#include "parser.h"
+
+/**
+ * Input formats of stream_evaluate():
+ *
+ *   STREAM_CSV   : a header line naming the columns, then one row per line
+ *                  of comma-separated numbers; every variable of the
+ *                  expression must name a column, other columns are
+ *                  skipped. One result per line, as printf("%f").
+ *   STREAM_BINARY: rows of native doubles, one per variable in the order of
+ *                  parser_var(), no header. One native double per row.
+ */
+
+enum stream_format {
+	STREAM_CSV,
+	STREAM_BINARY
+};
+
+struct stream_stats {
+	uint64_t rows;  /* rows evaluated */
+	uint64_t bytes; /* bytes of input */
+	uint64_t ns;    /* wall time */
+};
+
+/**
+ * Evaluates a compiled expression over every row of an input stream,
+ * writing the results to an output stream. Rows are gathered into blocks
+ * of columns for evaluate_batch(), and results are buffered, so the cost
+ * per row is that of parsing it. A regular file is mapped rather than
+ * read.
+ *
+ * parser: the expression, for the names of its variables
+ * fnc   : its evaluate_batch(), e.g. obtained by calling unit_lookup()
+ * format: the format of the input (and output)
+ * in    : the file descriptor of the input, e.g. 0
+ * out   : the file descriptor of the output, e.g. 1
+ * stats : receives the throughput, or NULL
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int stream_evaluate(const struct parser *parser,
+		    evaluate_batch_t fnc,
+		    enum stream_format format,
+		    int in,
+		    int out,
+		    struct stream_stats *stats);
+
+#endif /* _STREAM_H_ */
@@ -14,10 +14,23 @@
 
 /**
  * Needs:
+ *   clock_gettime()
  *   unlink()
  *   vsnprintf()
  */
 
+uint64_t
+ns_time(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+		TRACE("clock_gettime()");
+		return 0;
+	}
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
 void
 file_delete(const char *pathname)
 {
@@ -10,6 +10,7 @@
 #ifndef _SYSTEM_H_
 #define _SYSTEM_H_
 
+#include <time.h>
 #include <errno.h>
 #include <ctype.h>
 #include <stdio.h>
@@ -20,6 +21,9 @@
 #include <string.h>
 #include <assert.h>
 
+#define MIN(x,y) ( ((x) < (y)) ? (x) : (y) )
+#define MAX(x,y) ( ((x) > (y)) ? (x) : (y) )
+
 #define ARRAY_SIZE(a) ( (sizeof (a)) / (sizeof (a[0])) )
 
 #define TRACE(s)				\
@@ -47,6 +51,9 @@
 		}				\
 	} while (0)
 
+/* Monotonic reference time in nanoseconds, for measuring intervals */
+uint64_t ns_time(void);
+
 void file_delete(const char *pathname);
 
 void safe_sprintf(char *buf, size_t len, const char *format, ...);
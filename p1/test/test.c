@@ -0,0 +1,271 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * test.c
+ */
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+#include "../codegen.h"
+#include "../jitc.h"
+#include "../parser.h"
+#include "../registry.h"
+#include "../system.h"
+
+/**
+ * Checks of the p1 modules against what the command line cannot show:
+ * behaviour under concurrency, or numbers against a reference. Prints one
+ * line per test and exits non-zero if any failed.
+ *
+ * usage: test
+ */
+
+#define READERS 4
+#define PUBLISHES 2000
+
+/**
+ * registry: readers acquire, call and release a name without pause while a
+ * writer keeps republishing it, alternating two modules, and publishes a
+ * second name now and then whose module evicts the first (the budget fits
+ * one). Every acquired module must still be the one it was: it returns
+ * its own number, 1 or 2. Best run under -fsanitize=address, which turns a
+ * module reclaimed under a reader into a report.
+ */
+
+static struct {
+	struct registry *registry;
+	int stop;
+	uint64_t acquired[READERS];
+	int failed;
+} registry_;
+
+static void *
+reader(void *arg)
+{
+	struct registry_module *module;
+	evaluate_t fnc;
+	uint64_t *acquired;
+	double r;
+
+	acquired = (uint64_t *)arg;
+	while (!__atomic_load_n(&registry_.stop, __ATOMIC_ACQUIRE)) {
+		if (!(module = registry_acquire(registry_.registry, "f"))) {
+			continue; /* evicted */
+		}
+		fnc = (evaluate_t)registry_lookup(module, "evaluate");
+		r = fnc ? fnc(NULL, NULL) : 0.0;
+		if ((1.0 != r) && (2.0 != r)) {
+			__atomic_store_n(&registry_.failed, 1, __ATOMIC_RELAXED);
+		}
+		registry_release(registry_.registry, module);
+		++(*acquired);
+	}
+	return NULL;
+}
+
+static int
+test_registry(void)
+{
+	const char *SOURCES[] = {
+		"double evaluate(void *s, const double *x) { return 1; }",
+		"double evaluate(void *s, const double *x) { return 2; }"
+	};
+	char pathnames[ARRAY_SIZE(SOURCES)][64];
+	int fds[ARRAY_SIZE(SOURCES)];
+	pthread_t threads[READERS];
+	uint64_t total;
+	int i, n, e;
+
+	e = 0;
+	for (i=0; i<(int)ARRAY_SIZE(SOURCES); ++i) {
+		if ((0 > (fds[i] = jitc_memfd(pathnames[i], sizeof (pathnames[i])))) ||
+		    jitc_compile(SOURCES[i], pathnames[i], JITC_O0)) {
+			TRACE(0);
+			return -1;
+		}
+	}
+	memset(&registry_, 0, sizeof (registry_));
+	if (!(registry_.registry = registry_open(2, 1)) ||
+	    registry_publish(registry_.registry, "f", pathnames[0])) {
+		registry_close(registry_.registry);
+		TRACE(0);
+		return -1;
+	}
+	for (n=0; n<READERS; ++n) {
+		if (pthread_create(&threads[n],
+				   NULL,
+				   reader,
+				   &registry_.acquired[n])) {
+			TRACE("pthread_create()");
+			e = -1;
+			break;
+		}
+	}
+	for (i=0; !e && (i<PUBLISHES); ++i) {
+		if (registry_publish(registry_.registry,
+				     (i % 16) ? "f" : "g",
+				     pathnames[i & 1])) {
+			TRACE(0);
+			e = -1;
+		}
+	}
+	__atomic_store_n(&registry_.stop, 1, __ATOMIC_RELEASE);
+	total = 0;
+	for (i=0; i<n; ++i) {
+		pthread_join(threads[i], NULL);
+		total += registry_.acquired[i];
+	}
+	registry_close(registry_.registry);
+	for (i=0; i<(int)ARRAY_SIZE(SOURCES); ++i) {
+		close(fds[i]);
+	}
+	if (!total || registry_.failed) {
+		fprintf(stderr,
+			"registry: %lu acquisitions, %s\n",
+			(unsigned long)total,
+			registry_.failed ? "wrong module" : "none");
+		return -1;
+	}
+	return e;
+}
+
+/**
+ * grad: evaluate_grad() against central finite differences of its own
+ * value, for each variable of a few expressions covering every operator,
+ * at a few points.
+ */
+
+static int
+check_grad(const char *expression, const double *points, int n)
+{
+	const struct parser_dag *dag;
+	struct parser *parser;
+	evaluate_grad_t fnc;
+	double x[2], grad[2], scratch[2], fd, h, tol;
+	char pathname[64];
+	struct jitc *jitc;
+	char *source;
+	size_t len;
+	FILE *file;
+	int i, j, fd_, e;
+
+	jitc = NULL;
+	fd_ = -1;
+	source = NULL;
+	if (!(parser = parser_open(expression)) ||
+	    (2 < parser_vars(parser)) ||
+	    !(file = open_memstream(&source, &len))) {
+		parser_close(parser);
+		TRACE(0);
+		return -1;
+	}
+	dag = parser_dag(parser);
+	e = codegen_grad(dag, file);
+	fclose(file);
+	if (e ||
+	    (0 > (fd_ = jitc_memfd(pathname, sizeof (pathname)))) ||
+	    jitc_compile(source, pathname, JITC_O1) ||
+	    !(jitc = jitc_open(pathname)) ||
+	    !(fnc = (evaluate_grad_t)jitc_lookup(jitc, "evaluate_grad"))) {
+		jitc_close(jitc);
+		FREE(source);
+		if (0 <= fd_) {
+			close(fd_);
+		}
+		parser_close(parser);
+		TRACE(0);
+		return -1;
+	}
+	FREE(source);
+	e = 0;
+	for (i=0; !e && (i<n); ++i) {
+		memset(grad, 0, sizeof (grad));
+		fnc(&points[2 * i], grad);
+		for (j=0; !e && (j<parser_vars(parser)); ++j) {
+			memcpy(x, &points[2 * i], sizeof (x));
+			h = 1e-6 * MAX(1.0, fabs(x[j]));
+			x[j] = points[2 * i + j] + h;
+			fd = fnc(x, scratch);
+			x[j] = points[2 * i + j] - h;
+			fd = (fd - fnc(x, scratch)) / (2.0 * h);
+			tol = 1e-6 * MAX(1.0, fabs(fd));
+			if (fabs(grad[j] - fd) > tol) {
+				fprintf(stderr,
+					"grad: %s, d/d%s at (%g, %g): %.9g, "
+					"finite differences: %.9g\n",
+					expression,
+					parser_var(parser, j),
+					points[2 * i],
+					points[2 * i + 1],
+					grad[j],
+					fd);
+				e = -1;
+			}
+		}
+	}
+	jitc_close(jitc);
+	close(fd_);
+	parser_close(parser);
+	return e;
+}
+
+static int
+test_grad(void)
+{
+	const char *EXPRESSIONS[] = {
+		"x * y - x / y + -x",
+		"exp(x * y) + log(x + y)",
+		"tanh(x - y) * sigmoid(x / y)",
+		"(x + y) * (x + y) / exp(x)" /* a shared subexpression */
+	};
+	const double POINTS[] = {
+		0.5, 2.0,
+		1.5, 0.25,
+		-0.75, 3.0
+	};
+	int i, e;
+
+	e = 0;
+	for (i=0; i<(int)ARRAY_SIZE(EXPRESSIONS); ++i) {
+		if (check_grad(EXPRESSIONS[i], POINTS, ARRAY_SIZE(POINTS) / 2)) {
+			e = -1;
+		}
+	}
+	return e;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const struct {
+		const char *name;
+		int (*fnc)(void);
+	} TESTS[] = {
+		{ "registry", test_registry },
+		{ "grad", test_grad }
+	};
+	int i, e;
+
+	(void)argv;
+	if (1 != argc) {
+		printf("usage: test\n");
+		return -1;
+	}
+	e = 0;
+	for (i=0; i<(int)ARRAY_SIZE(TESTS); ++i) {
+		if (TESTS[i].fnc()) {
+			printf("FAIL %s\n", TESTS[i].name);
+			e = -1;
+		}
+		else {
+			printf("ok   %s\n", TESTS[i].name);
+		}
+	}
+	return e;
+}
@@ -0,0 +1,404 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * tier.c
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <unistd.h>
+#include "jitc.h"
+#include "vm.h"
+#include "tier.h"
+
+/**
+ * Needs:
+ *   pthread_create()
+ *   pthread_join()
+ */
+
+/**
+ * The number of interpreted inputs kept to train -O3 builds on, see
+ * jitc_compile_pgo().
+ */
+
+#define SAMPLES 64
+
+enum {
+	PROMOTE_IDLE, /* nothing running, the next checkpoint may start one */
+	PROMOTE_RUNNING,
+	PROMOTE_FAILED
+};
+
+struct tier {
+	const struct parser_dag *dag;
+	struct vm *vm; /* the interpreter */
+	struct policy *policy;
+	uint64_t threshold;
+	int promote; /* PROMOTE_* */
+	int started; /* thread needs joining */
+	pthread_t thread;
+	enum jitc_level target; /* the level being compiled */
+	enum jitc_level level; /* the level of fnc */
+	int pgo; /* fnc is profile-guided, see compile() */
+	uint64_t checkpoint; /* compiled evaluations before reconsidering */
+	uint64_t since[2]; /* compiled evaluations and ns when fnc was set */
+	struct jitc *jitc[JITC_END]; /* kept, evaluations may still run them */
+	int fd[JITC_END]; /* back jitc, see jitc_memfd() */
+	int compiles;
+	evaluate_t fnc; /* published once compiled */
+	uint64_t compile_ns;
+	uint64_t evaluations[TIER_END];
+	uint64_t ns[TIER_END];
+	int nvars; /* the length of x */
+	int sampled; /* slots claimed, may exceed SAMPLES */
+	int ready[SAMPLES]; /* slot filled */
+	sigmoid_t sigmoid; /* of the first sample */
+	double *samples; /* SAMPLES rows of nvars */
+};
+
+/**
+ * Trains an instrumented module on the sampled inputs.
+ */
+
+static int
+train(struct jitc *jitc, void *arg)
+{
+	struct tier *tier;
+	evaluate_t fnc;
+	int i;
+
+	tier = (struct tier *)arg;
+	if (!(fnc = (evaluate_t)jitc_lookup(jitc, "evaluate"))) {
+		TRACE(0);
+		return -1;
+	}
+	for (i=0; i<SAMPLES; ++i) {
+		if (__atomic_load_n(&tier->ready[i], __ATOMIC_ACQUIRE)) {
+			fnc(tier->sigmoid, tier->samples + (size_t)i * tier->nvars);
+		}
+	}
+	return 0;
+}
+
+/**
+ * Keeps a copy of x, if there is room left, for train().
+ */
+
+static void
+sample(struct tier *tier, sigmoid_t sigmoid, const double *x)
+{
+	int i;
+
+	if (!x || !tier->samples ||
+	    (SAMPLES <= __atomic_load_n(&tier->sampled, __ATOMIC_RELAXED))) {
+		return;
+	}
+	if (SAMPLES <= (i = __atomic_fetch_add(&tier->sampled,
+					       1,
+					       __ATOMIC_RELAXED))) {
+		return;
+	}
+	if (!i) {
+		tier->sigmoid = sigmoid;
+	}
+	memcpy(tier->samples + (size_t)i * tier->nvars,
+	       x,
+	       tier->nvars * sizeof (x[0]));
+	__atomic_store_n(&tier->ready[i], 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Compiles the expression at tier->target into a module of its own, the
+ * -O3 build guided by the sampled inputs when there are any. The policy
+ * only learns from plain builds: a profile-guided one costs two gcc runs
+ * and a training run, and runs faster than -O3 usually does, so its
+ * timings would skew the -O3 model that every other compilation uses.
+ */
+
+static int
+compile(struct tier *tier)
+{
+	enum jitc_level level;
+	int pgo;
+	char pathname[64];
+	evaluate_t fnc;
+	char *source;
+	FILE *file;
+	uint64_t t;
+	size_t len;
+
+	level = tier->target;
+	if (!(file = open_memstream(&source, &len))) {
+		TRACE("open_memstream()");
+		return -1;
+	}
+	if (codegen(tier->dag, file)) {
+		fclose(file);
+		FREE(source);
+		TRACE(0);
+		return -1;
+	}
+	fclose(file);
+	if (0 > (tier->fd[level] = jitc_memfd(pathname, sizeof (pathname)))) {
+		FREE(source);
+		TRACE(0);
+		return -1;
+	}
+	pgo = (JITC_O3 == level) &&
+	      __atomic_load_n(&tier->ready[0], __ATOMIC_ACQUIRE);
+	t = ns_time();
+	if (pgo ?
+	    jitc_compile_pgo(source, pathname, level, train, tier) :
+	    jitc_compile(source, pathname, level)) {
+		FREE(source);
+		TRACE(0);
+		return -1;
+	}
+	t = ns_time() - t;
+	FREE(source);
+	if (tier->policy && !pgo) {
+		policy_compiled(tier->policy, level, tier->dag->id, t);
+	}
+	if (!(tier->jitc[level] = jitc_open(pathname)) ||
+	    !(fnc = (evaluate_t)jitc_lookup(tier->jitc[level], "evaluate"))) {
+		TRACE(0);
+		return -1;
+	}
+	__atomic_store_n(&tier->level, level, __ATOMIC_RELAXED);
+	tier->pgo = pgo;
+	__atomic_store_n(&tier->fnc, fnc, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/**
+ * Schedules the next checkpoint for when the total number of evaluations
+ * has doubled: having been evaluated n times, the expression is expected
+ * to be evaluated about n more times.
+ */
+
+static void
+schedule(struct tier *tier)
+{
+	uint64_t total, compiled;
+
+	compiled = __atomic_load_n(&tier->evaluations[TIER_COMPILED],
+				   __ATOMIC_RELAXED);
+	total = compiled + __atomic_load_n(&tier->evaluations[TIER_INTERPRETED],
+					   __ATOMIC_RELAXED);
+	__atomic_store_n(&tier->checkpoint,
+			 tier->policy ?
+			 (compiled + MAX(total, tier->threshold)) :
+			 UINT64_MAX,
+			 __ATOMIC_RELAXED);
+}
+
+static void *
+promote(void *arg)
+{
+	struct tier *tier;
+	uint64_t t;
+
+	tier = (struct tier *)arg;
+	t = ns_time();
+	if (compile(tier)) {
+		__atomic_store_n(&tier->promote, PROMOTE_FAILED, __ATOMIC_RELEASE);
+		TRACE("promotion failed, staying at the current tier");
+		return NULL;
+	}
+	__atomic_add_fetch(&tier->compile_ns, ns_time() - t, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&tier->compiles, 1, __ATOMIC_RELAXED);
+	tier->since[0] = __atomic_load_n(&tier->evaluations[TIER_COMPILED],
+					 __ATOMIC_RELAXED);
+	tier->since[1] = __atomic_load_n(&tier->ns[TIER_COMPILED],
+					 __ATOMIC_RELAXED);
+	schedule(tier);
+	__atomic_store_n(&tier->promote, PROMOTE_IDLE, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/**
+ * Run by the one evaluation that claimed a checkpoint: reports how the
+ * current module has been doing and, if the expected remaining evaluations
+ * justify a higher optimization level (or nothing is compiled yet), starts
+ * compiling in the background.
+ */
+
+static void
+reconsider(struct tier *tier)
+{
+	uint64_t evaluations, ns, total;
+	enum jitc_level target;
+
+	evaluations = __atomic_load_n(&tier->evaluations[TIER_COMPILED],
+				      __ATOMIC_RELAXED);
+	ns = __atomic_load_n(&tier->ns[TIER_COMPILED], __ATOMIC_RELAXED);
+	total = evaluations +
+		__atomic_load_n(&tier->evaluations[TIER_INTERPRETED],
+				__ATOMIC_RELAXED);
+	target = JITC_O3;
+	if (tier->policy) {
+		if (tier->fnc && !tier->pgo) {
+			policy_evaluated(tier->policy,
+					 tier->level,
+					 tier->dag->id,
+					 evaluations - tier->since[0],
+					 ns - tier->since[1]);
+		}
+		target = policy_level(tier->policy, tier->dag->id, total);
+	}
+	if (tier->fnc && (target <= tier->level)) {
+		tier->since[0] = evaluations;
+		tier->since[1] = ns;
+		schedule(tier);
+		__atomic_store_n(&tier->promote, PROMOTE_IDLE, __ATOMIC_RELEASE);
+		return;
+	}
+	tier->target = target;
+	if (tier->started) {
+		pthread_join(tier->thread, NULL); /* done, see promote() */
+		tier->started = 0;
+	}
+	if (pthread_create(&tier->thread, NULL, promote, tier)) {
+		__atomic_store_n(&tier->promote, PROMOTE_IDLE, __ATOMIC_RELEASE);
+		TRACE("pthread_create()");
+		return;
+	}
+	tier->started = 1;
+}
+
+struct tier *
+tier_open(const struct parser_dag *dag,
+	  uint64_t threshold,
+	  struct policy *policy)
+{
+	const struct parser_dag *node;
+	struct tier *tier;
+	int i;
+
+	assert( dag );
+
+	if (!(tier = malloc(sizeof (struct tier)))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(tier, 0, sizeof (struct tier));
+	for (i=0; i<JITC_END; ++i) {
+		tier->fd[i] = -1;
+	}
+	if (!(tier->vm = vm_open(dag))) {
+		tier_close(tier);
+		TRACE(0);
+		return NULL;
+	}
+	for (node=dag-(dag->id-1); node<=dag; ++node) {
+		if (PARSER_DAG_VAR == node->op) {
+			tier->nvars = MAX(tier->nvars, node->var + 1);
+		}
+	}
+	if (tier->nvars &&
+	    !(tier->samples = malloc(SAMPLES *
+				     tier->nvars *
+				     sizeof (tier->samples[0])))) {
+		tier_close(tier);
+		TRACE("out of memory");
+		return NULL;
+	}
+	tier->dag = dag;
+	tier->policy = policy;
+	tier->threshold = threshold;
+	tier->checkpoint = UINT64_MAX;
+	tier->promote = PROMOTE_IDLE;
+	return tier;
+}
+
+void
+tier_close(struct tier *tier)
+{
+	int i;
+
+	if (tier) {
+		if (tier->started) {
+			pthread_join(tier->thread, NULL);
+		}
+		for (i=0; i<JITC_END; ++i) {
+			jitc_close(tier->jitc[i]);
+			if (0 <= tier->fd[i]) {
+				close(tier->fd[i]);
+			}
+		}
+		vm_close(tier->vm);
+		FREE(tier->samples);
+		memset(tier, 0, sizeof (struct tier));
+	}
+	FREE(tier);
+}
+
+double
+tier_evaluate(struct tier *tier, sigmoid_t sigmoid, const double *x)
+{
+	enum tier_level level;
+	evaluate_t fnc;
+	uint64_t t, n;
+	int idle;
+	double r;
+
+	assert( tier );
+
+	t = ns_time();
+	if ((fnc = __atomic_load_n(&tier->fnc, __ATOMIC_ACQUIRE))) {
+		level = TIER_COMPILED;
+		r = fnc(sigmoid, x);
+	}
+	else {
+		level = TIER_INTERPRETED;
+		r = vm_evaluate(tier->vm, sigmoid, x);
+		sample(tier, sigmoid, x);
+	}
+	t = ns_time() - t;
+	n = __atomic_add_fetch(&tier->evaluations[level], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&tier->ns[level], t, __ATOMIC_RELAXED);
+
+	/* hot: exactly one caller claims each checkpoint */
+
+	idle = PROMOTE_IDLE;
+	if ((n >= ((TIER_INTERPRETED == level) ?
+		   tier->threshold :
+		   __atomic_load_n(&tier->checkpoint, __ATOMIC_RELAXED))) &&
+	    __atomic_compare_exchange_n(&tier->promote,
+					&idle,
+					PROMOTE_RUNNING,
+					0,
+					__ATOMIC_ACQ_REL,
+					__ATOMIC_RELAXED)) {
+		reconsider(tier);
+	}
+	return r;
+}
+
+void
+tier_stats(const struct tier *tier, struct tier_stats *stats)
+{
+	int i;
+
+	assert( tier );
+	assert( stats );
+
+	memset(stats, 0, sizeof (struct tier_stats));
+	for (i=0; i<TIER_END; ++i) {
+		stats->evaluations[i] = __atomic_load_n(&tier->evaluations[i],
+							__ATOMIC_RELAXED);
+		stats->ns[i] = __atomic_load_n(&tier->ns[i], __ATOMIC_RELAXED);
+	}
+	stats->compile_ns = __atomic_load_n(&tier->compile_ns, __ATOMIC_RELAXED);
+	stats->compiles = __atomic_load_n(&tier->compiles, __ATOMIC_RELAXED);
+	stats->level = TIER_INTERPRETED;
+	if (__atomic_load_n(&tier->fnc, __ATOMIC_ACQUIRE)) {
+		stats->level = TIER_COMPILED;
+		stats->opt = __atomic_load_n(&tier->level, __ATOMIC_RELAXED);
+	}
+}
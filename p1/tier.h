@@ -0,0 +1,98 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * tier.h
+ */
+
+#ifndef _TIER_H_
+#define _TIER_H_
+
+#include "codegen.h"
+#include "policy.h"
+
+/**
+ * Execution tiers, from cheapest to start to cheapest to run.
+ */
+
+enum tier_level {
+	TIER_INTERPRETED,
+	TIER_COMPILED,
+	TIER_END
+};
+
+struct tier_stats {
+	uint64_t evaluations[TIER_END]; /* number of evaluations per tier */
+	uint64_t ns[TIER_END];          /* total evaluation time per tier */
+	uint64_t compile_ns;            /* background compile time, 0 if none */
+	int compiles;                   /* background compilations */
+	enum tier_level level;          /* the current tier */
+	enum jitc_level opt;            /* TIER_COMPILED: the current level */
+};
+
+struct tier;
+
+/**
+ * Opens a tiered evaluator for dag. Evaluations start in the bytecode VM;
+ * once threshold evaluations have been interpreted the expression is JIT
+ * compiled in a background thread and its entry point swapped in
+ * atomically, without blocking concurrent evaluations.
+ *
+ * With a policy, the optimization level is the one policy_level() picks for
+ * as many evaluations again as seen so far. Every time the evaluation count
+ * doubles the choice is revisited, and the expression recompiled at a
+ * higher level if it has become hot enough to pay for it.
+ *
+ * The first interpreted inputs are kept, and -O3 builds are profile-guided
+ * by a training run over them (see jitc_compile_pgo()); the policy sees
+ * the cost of both builds as the compile time.
+ *
+ * dag      : the expression previously obtained by calling parser_dag(); it
+ *            must outlive the tier
+ * threshold: the number of interpreted evaluations before promotion
+ * policy   : the optimization policy, or NULL to compile once at -O3; it
+ *            must outlive the tier
+ *
+ * return: an opaque handle or NULL on error
+ */
+
+struct tier *tier_open(const struct parser_dag *dag,
+		       uint64_t threshold,
+		       struct policy *policy);
+
+/**
+ * Closes a previously opened tier handle, waiting for any background
+ * compilation to finish.
+ *
+ * tier: an opaque handle previously obtained by calling tier_open()
+ *
+ * Note: tier may be NULL.
+ */
+
+void tier_close(struct tier *tier);
+
+/**
+ * Evaluates the expression in the highest tier available. May be called
+ * concurrently from multiple threads.
+ *
+ * tier   : an opaque handle previously obtained by calling tier_open()
+ * sigmoid: the sigmoid applied to the value of the expression
+ * x      : the values of the variables (see parser_var())
+ *
+ * return: the result, as returned by evaluate()
+ */
+
+double tier_evaluate(struct tier *tier, sigmoid_t sigmoid, const double *x);
+
+/**
+ * Reports per-tier evaluation counts and latencies.
+ *
+ * tier : an opaque handle previously obtained by calling tier_open()
+ * stats: receives the statistics
+ */
+
+void tier_stats(const struct tier *tier, struct tier_stats *stats);
+
+#endif /* _TIER_H_ */
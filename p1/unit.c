@@ -0,0 +1,162 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * unit.c
+ */
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include "jitc.h"
+#include "unit.h"
+
+struct unit {
+	int n;
+	enum jitc_level level;
+	int fd; /* backs jitc when uncached, see jitc_memfd() */
+	struct jitc *jitc;
+};
+
+static char *
+generate(const struct parser_dag * const *dags, int n)
+{
+	char *source;
+	FILE *file;
+	size_t len;
+
+	if (!(file = open_memstream(&source, &len))) {
+		TRACE("open_memstream()");
+		return NULL;
+	}
+	if (codegen_unit(dags, n, file)) {
+		fclose(file);
+		FREE(source);
+		TRACE(0);
+		return NULL;
+	}
+	fclose(file);
+	return source;
+}
+
+static int
+compile(struct unit *unit,
+	const char *source,
+	struct cache *cache,
+	struct policy *policy,
+	int nodes)
+{
+	const char *pathname;
+	char buf[64];
+	uint64_t ns;
+
+	if (cache) {
+		if (!(pathname = cache_compile(cache, source, unit->level, &ns))) {
+			TRACE(0);
+			return -1;
+		}
+	}
+	else {
+		if (0 > (unit->fd = jitc_memfd(buf, sizeof (buf)))) {
+			TRACE(0);
+			return -1;
+		}
+		ns = ns_time();
+		if (jitc_compile(source, buf, unit->level)) {
+			TRACE(0);
+			return -1;
+		}
+		ns = ns_time() - ns;
+		pathname = buf;
+	}
+	if (policy && ns) {
+		policy_compiled(policy, unit->level, nodes, ns);
+	}
+	if (!(unit->jitc = jitc_open(pathname))) {
+		TRACE(0);
+		return -1;
+	}
+	return 0;
+}
+
+struct unit *
+unit_open(const struct parser_dag * const *dags,
+	  int n,
+	  struct cache *cache,
+	  struct policy *policy,
+	  uint64_t evaluations)
+{
+	struct unit *unit;
+	char *source;
+	int i, nodes;
+
+	assert( dags && (0 < n) );
+
+	if (!(unit = malloc(sizeof (struct unit)))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(unit, 0, sizeof (struct unit));
+	unit->n = n;
+	unit->fd = -1;
+	for (i=0, nodes=0; i<n; ++i) {
+		nodes += dags[i]->id;
+	}
+	unit->level = policy ? policy_level(policy, nodes, evaluations) : JITC_O3;
+	if (!(source = generate(dags, n))) {
+		unit_close(unit);
+		TRACE(0);
+		return NULL;
+	}
+	if (compile(unit, source, cache, policy, nodes)) {
+		FREE(source);
+		unit_close(unit);
+		TRACE(0);
+		return NULL;
+	}
+	FREE(source);
+	return unit;
+}
+
+void
+unit_close(struct unit *unit)
+{
+	if (unit) {
+		jitc_close(unit->jitc);
+		if (0 <= unit->fd) {
+			close(unit->fd);
+		}
+		memset(unit, 0, sizeof (struct unit));
+	}
+	FREE(unit);
+}
+
+enum jitc_level
+unit_level(const struct unit *unit)
+{
+	assert( unit );
+
+	return unit->level;
+}
+
+struct jitc *
+unit_jitc(const struct unit *unit)
+{
+	assert( unit );
+
+	return unit->jitc;
+}
+
+long
+unit_lookup(const struct unit *unit, int i, const char *symbol)
+{
+	char buf[256];
+
+	assert( unit );
+	assert( (0 <= i) && (i < unit->n) );
+
+	safe_sprintf(buf, sizeof (buf), "%s_%d", symbol, i);
+	return jitc_lookup(unit->jitc, buf);
+}
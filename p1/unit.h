@@ -0,0 +1,80 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * unit.h
+ */
+
+#ifndef _UNIT_H_
+#define _UNIT_H_
+
+#include "cache.h"
+#include "codegen.h"
+#include "policy.h"
+
+struct unit;
+
+/**
+ * Compiles n expressions as a single translation unit, i.e., with one gcc
+ * invocation, and loads the resulting module. Expression i is exported as
+ * evaluate_<i>() and evaluate_batch_<i>().
+ *
+ * dags       : the expressions previously obtained by calling parser_dag()
+ * n          : the number of expressions
+ * cache      : the module cache to compile through, or NULL to always
+ *              compile
+ * policy     : picks the optimization level and is told how long gcc took,
+ *              or NULL to always compile at -O3
+ * evaluations: the number of evaluations expected, see policy_level()
+ *
+ * return: an opaque handle or NULL on error
+ */
+
+struct unit *unit_open(const struct parser_dag * const *dags,
+		       int n,
+		       struct cache *cache,
+		       struct policy *policy,
+		       uint64_t evaluations);
+
+/**
+ * Unloads a previously compiled unit.
+ *
+ * unit: an opaque handle previously obtained by calling unit_open()
+ *
+ * Note: unit may be NULL.
+ */
+
+void unit_close(struct unit *unit);
+
+/**
+ * Returns the optimization level the unit was compiled at.
+ *
+ * unit: an opaque handle previously obtained by calling unit_open()
+ */
+
+enum jitc_level unit_level(const struct unit *unit);
+
+/**
+ * Returns the module holding the unit, for use with jitc_lookup().
+ *
+ * unit: an opaque handle previously obtained by calling unit_open()
+ */
+
+struct jitc *unit_jitc(const struct unit *unit);
+
+/**
+ * Searches for symbol<_i> in the unit, e.g. unit_lookup(unit, 3, "evaluate")
+ * returns the address of evaluate_3().
+ *
+ * unit  : an opaque handle previously obtained by calling unit_open()
+ * i     : the index of the expression, as given to unit_open()
+ * symbol: "evaluate" or "evaluate_batch"
+ *
+ * return: the memory address of the start of the symbol, or 0 on error
+ */
+
+long unit_lookup(const struct unit *unit, int i, const char *symbol);
+
+#endif /* _UNIT_H_ */
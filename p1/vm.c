@@ -0,0 +1,291 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * vm.c
+ */
+
+#include <pthread.h>
+#include "intrinsic.h"
+#include "vm.h"
+
+/**
+ * Needs:
+ *   pthread_once()
+ *   pthread_getspecific()
+ */
+
+/**
+ * An instruction is the address of its handler in execute() (direct
+ * threading: dispatch is one indirect jump, no decode) and three register
+ * operands. Registers are the nodes' ids, r[0] is unused. Operand a of
+ * VM_VAR is the index of the variable, of VM_VAL the index of the constant.
+ */
+
+enum vm_op {
+	VM_VAR,
+	VM_VAL,
+	VM_NEG,
+	VM_MUL,
+	VM_DIV,
+	VM_ADD,
+	VM_SUB,
+	VM_EXP,
+	VM_LOG,
+	VM_TANH,
+	VM_SIGMOID,
+	VM_RET,
+	VM_END
+};
+
+struct insn {
+	const void *op;
+	int dst;
+	int a;
+	int b;
+};
+
+struct vm {
+	int n; /* registers */
+	struct insn *code;
+	double *vals; /* constants */
+};
+
+#define REGISTERS 256 /* on the stack of vm_evaluate() */
+
+/**
+ * Registers beyond REGISTERS come from a register file per thread, grown to
+ * the largest vm it has evaluated and freed when the thread exits, so
+ * evaluations allocate only when a thread first meets a larger vm.
+ */
+
+struct scratch {
+	int n;
+	double r[1];
+};
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+static int keyed;
+
+static void
+key_create(void)
+{
+	keyed = !pthread_key_create(&key, free);
+}
+
+static double *
+scratch(int n)
+{
+	struct scratch *scratch, *bigger;
+
+	if (!keyed) {
+		TRACE("pthread_key_create()");
+		return NULL;
+	}
+	scratch = pthread_getspecific(key);
+	if (!scratch || (scratch->n < n)) {
+		if (!(bigger = realloc(scratch,
+				       sizeof (struct scratch) +
+				       (size_t)(n - 1) * sizeof (double)))) {
+			TRACE("out of memory");
+			return NULL;
+		}
+		bigger->n = n;
+		if (pthread_setspecific(key, bigger)) {
+			FREE(bigger);
+			TRACE("pthread_setspecific()");
+			return NULL;
+		}
+		scratch = bigger;
+	}
+	return scratch->r;
+}
+
+/**
+ * Runs the bytecode of vm with registers r. If labels is not NULL, nothing
+ * runs: labels[VM_END] receives the handler addresses, indexed by vm_op,
+ * since they are only known inside this function. It must therefore
+ * never be inlined or cloned: each copy would have its own handlers.
+ */
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic" /* labels as values */
+
+static double __attribute__((noinline, noclone))
+execute(const struct vm *vm, const double *x, double *r, const void **labels)
+{
+	static const void * const LABELS[VM_END] = {
+		&&op_var,
+		&&op_val,
+		&&op_neg,
+		&&op_mul,
+		&&op_div,
+		&&op_add,
+		&&op_sub,
+		&&op_exp,
+		&&op_log,
+		&&op_tanh,
+		&&op_sigmoid,
+		&&op_ret
+	};
+	const struct insn *pc;
+
+#define NEXT goto *(++pc)->op
+
+	if (labels) {
+		memcpy((void *)labels, LABELS, sizeof (LABELS));
+		return 0.0;
+	}
+	pc = vm->code;
+	goto *pc->op;
+ op_var:
+	r[pc->dst] = x[pc->a];
+	NEXT;
+ op_val:
+	r[pc->dst] = vm->vals[pc->a];
+	NEXT;
+ op_neg:
+	r[pc->dst] = - r[pc->b];
+	NEXT;
+ op_mul:
+	r[pc->dst] = r[pc->a] * r[pc->b];
+	NEXT;
+ op_div:
+	r[pc->dst] = r[pc->b] ? (r[pc->a] / r[pc->b]) : 0.0;
+	NEXT;
+ op_add:
+	r[pc->dst] = r[pc->a] + r[pc->b];
+	NEXT;
+ op_sub:
+	r[pc->dst] = r[pc->a] - r[pc->b];
+	NEXT;
+ op_exp:
+	r[pc->dst] = intrinsic_exp(r[pc->b]);
+	NEXT;
+ op_log:
+	r[pc->dst] = intrinsic_log(r[pc->b]);
+	NEXT;
+ op_tanh:
+	r[pc->dst] = intrinsic_tanh(r[pc->b]);
+	NEXT;
+ op_sigmoid:
+	r[pc->dst] = intrinsic_sigmoid(r[pc->b]);
+	NEXT;
+ op_ret:
+	return r[pc->a];
+
+#undef NEXT
+}
+
+#pragma GCC diagnostic pop
+
+/* by parser_dag_op */
+
+static const enum vm_op VM_OP[] = {
+	VM_END,
+	VM_VAL,
+	VM_NEG,
+	VM_MUL,
+	VM_DIV,
+	VM_ADD,
+	VM_SUB,
+	VM_VAR,
+	VM_EXP,
+	VM_LOG,
+	VM_TANH,
+	VM_SIGMOID
+};
+
+struct vm *
+vm_open(const struct parser_dag *dag)
+{
+	const struct parser_dag **order;
+	const void *labels[VM_END];
+	struct insn *insn;
+	struct vm *vm;
+	int i, k;
+
+	assert( dag );
+
+	if (!(vm = malloc(sizeof (struct vm)))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(vm, 0, sizeof (struct vm));
+	vm->n = dag->id + 1;
+	pthread_once(&once, key_create);
+	order = malloc((size_t)dag->id * sizeof (order[0]));
+	vm->code = malloc((size_t)vm->n * sizeof (vm->code[0]));
+	vm->vals = malloc((size_t)dag->id * sizeof (vm->vals[0]));
+	if (!order || !vm->code || !vm->vals) {
+		FREE(order);
+		vm_close(vm);
+		TRACE("out of memory");
+		return NULL;
+	}
+	execute(NULL, NULL, NULL, labels);
+	parser_order(dag, order);
+	for (i=0, k=0; i<vm->n - 1; ++i) {
+		dag = order[i];
+		insn = &vm->code[i];
+		assert( (int)dag->op < (int)ARRAY_SIZE(VM_OP) );
+		assert( VM_END != VM_OP[dag->op] );
+
+		insn->op = labels[VM_OP[dag->op]];
+		insn->dst = dag->id;
+		insn->a = dag->left ? dag->left->id : 0;
+		insn->b = dag->right ? dag->right->id : 0;
+		if (PARSER_DAG_VAR == dag->op) {
+			insn->a = dag->var;
+		}
+		else if (PARSER_DAG_VAL == dag->op) {
+			vm->vals[k] = dag->val;
+			insn->a = k++;
+		}
+	}
+	insn = &vm->code[i];
+	insn->op = labels[VM_RET];
+	insn->dst = 0;
+	insn->a = dag->id;
+	insn->b = 0;
+	FREE(order);
+
+	/* the opening thread, at least, evaluates without allocating */
+
+	if ((REGISTERS < vm->n) && !scratch(vm->n)) {
+		vm_close(vm);
+		TRACE(0);
+		return NULL;
+	}
+	return vm;
+}
+
+void
+vm_close(struct vm *vm)
+{
+	if (vm) {
+		FREE(vm->code);
+		FREE(vm->vals);
+		memset(vm, 0, sizeof (struct vm));
+	}
+	FREE(vm);
+}
+
+double
+vm_evaluate(const struct vm *vm, sigmoid_t sigmoid, const double *x)
+{
+	double buf[REGISTERS], *r;
+
+	assert( vm );
+
+	/* registers are per thread, so evaluations may run concurrently */
+
+	r = buf;
+	if ((REGISTERS < vm->n) && !(r = scratch(vm->n))) {
+		return 0.0 / 0.0;
+	}
+	return sigmoid(execute(vm, x, r, NULL));
+}
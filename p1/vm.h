@@ -0,0 +1,53 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * vm.h
+ */
+
+#ifndef _VM_H_
+#define _VM_H_
+
+#include "codegen.h"
+
+struct vm;
+
+/**
+ * Compiles dag into register-machine bytecode for a direct-threaded
+ * interpreter: no gcc, no executable memory, and a cost per evaluation
+ * proportional to the number of distinct nodes. Each node is one
+ * instruction writing the register numbered by its id.
+ *
+ * dag: the expression previously obtained by calling parser_dag()
+ *
+ * return: an opaque handle or NULL on error
+ */
+
+struct vm *vm_open(const struct parser_dag *dag);
+
+/**
+ * Releases the bytecode associated with vm.
+ *
+ * vm: an opaque handle previously obtained by calling vm_open()
+ *
+ * Note: vm may be NULL.
+ */
+
+void vm_close(struct vm *vm);
+
+/**
+ * Evaluates the expression. May be called concurrently from multiple
+ * threads.
+ *
+ * vm     : an opaque handle previously obtained by calling vm_open()
+ * sigmoid: the sigmoid applied to the value of the expression
+ * x      : the values of the variables (see parser_var())
+ *
+ * return: the result, as returned by evaluate()
+ */
+
+double vm_evaluate(const struct vm *vm, sigmoid_t sigmoid, const double *x);
+
+#endif /* _VM_H_ */
@@ -0,0 +1,361 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * x64.c
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include "intrinsic.h"
+#include "system.h"
+#include "x64.h"
+
+/**
+ * Needs:
+ *   mmap()
+ *   mprotect()
+ *   munmap()
+ */
+
+/**
+ * The emitted function has the signature of evaluate(sigmoid, x), i.e., rdi
+ * holds sigmoid and rsi the variables. Every dag node owns an 8-byte slot at
+ * [rsp + 8 * id] in its frame. Each node is computed in xmm0 (xmm1/xmm2 as
+ * scratch) and spilled to its slot; the epilogue leaves the root in xmm0 and
+ * tail-calls sigmoid through rdi.
+ *
+ * Intrinsics are calls to intrinsic_exp() and friends. rdi and rsi are
+ * saved in the two slots past the root's, and restored after each call;
+ * the frame keeps rsp 16-byte aligned at the call.
+ */
+
+#define PAGE 4096
+#define MAX_FRAME (1024 * 1024)
+
+struct x64 {
+	void *code;
+	size_t size;
+};
+
+struct emitter {
+	unsigned char *buf;
+	size_t size;
+	size_t cap;
+	int last; /* id of the node currently in xmm0, or 0 */
+	uint32_t save; /* where rdi and rsi are saved, rsi 8 bytes above */
+	int error;
+};
+
+static void
+emit(struct emitter *e, const unsigned char *p, size_t n)
+{
+	unsigned char *buf;
+	size_t cap;
+
+	if (e->error) {
+		return;
+	}
+	if (e->size + n > e->cap) {
+		cap = e->cap ? (2 * e->cap) : PAGE;
+		while (cap < e->size + n) {
+			cap *= 2;
+		}
+		if (!(buf = realloc(e->buf, cap))) {
+			TRACE("out of memory");
+			e->error = 1;
+			return;
+		}
+		e->buf = buf;
+		e->cap = cap;
+	}
+	memcpy(e->buf + e->size, p, n);
+	e->size += n;
+}
+
+static void
+emit_u32(struct emitter *e, uint32_t v)
+{
+	unsigned char b[4];
+	int i;
+
+	for (i=0; i<4; ++i) {
+		b[i] = (unsigned char)(v >> (8 * i));
+	}
+	emit(e, b, sizeof (b));
+}
+
+static void
+emit_u64(struct emitter *e, uint64_t v)
+{
+	emit_u32(e, (uint32_t)v);
+	emit_u32(e, (uint32_t)(v >> 32));
+}
+
+/**
+ * Emits prefix + opcode followed by a ModRM/SIB addressing [rsp + disp32]
+ * with reg in the ModRM reg field.
+ */
+
+static void
+emit_rsp(struct emitter *e,
+	 const unsigned char *op,
+	 size_t n,
+	 int reg,
+	 uint32_t disp)
+{
+	unsigned char b[2];
+
+	b[0] = (unsigned char)(0x84 | (reg << 3));
+	b[1] = 0x24;
+	emit(e, op, n);
+	emit(e, b, sizeof (b));
+	emit_u32(e, disp);
+}
+
+static uint32_t
+slot(int id)
+{
+	return (uint32_t)(8 * id);
+}
+
+static void
+load(struct emitter *e, int reg, int id)
+{
+	const unsigned char MOVSD[] = { 0xf2, 0x0f, 0x10 };
+
+	if (!reg && (id == e->last)) {
+		return;
+	}
+	emit_rsp(e, MOVSD, sizeof (MOVSD), reg, slot(id));
+}
+
+static void
+store(struct emitter *e, int id)
+{
+	const unsigned char MOVSD[] = { 0xf2, 0x0f, 0x11 };
+
+	emit_rsp(e, MOVSD, sizeof (MOVSD), 0, slot(id));
+	e->last = id;
+}
+
+static double
+(*intrinsic(enum parser_dag_op op))(double)
+{
+	if (PARSER_DAG_EXP == op) {
+		return intrinsic_exp;
+	}
+	if (PARSER_DAG_LOG == op) {
+		return intrinsic_log;
+	}
+	if (PARSER_DAG_TANH == op) {
+		return intrinsic_tanh;
+	}
+	if (PARSER_DAG_SIGMOID == op) {
+		return intrinsic_sigmoid;
+	}
+	return NULL;
+}
+
+static void
+reflect(struct emitter *e, const struct parser_dag *dag)
+{
+	const unsigned char MOVABS_RAX[] = { 0x48, 0xb8 };
+	const unsigned char MOV_M_RAX[] = { 0x48, 0x89 };
+	const unsigned char MOV_RAX_M[] = { 0x48, 0x8b };
+	const unsigned char BTC_RAX_63[] = { 0x48, 0x0f, 0xba, 0xf8, 0x3f };
+	const unsigned char MULSD[] = { 0xf2, 0x0f, 0x59 };
+	const unsigned char ADDSD[] = { 0xf2, 0x0f, 0x58 };
+	const unsigned char SUBSD[] = { 0xf2, 0x0f, 0x5c };
+	const unsigned char GUARDED_DIV[] = {
+		0x66, 0x0f, 0x57, 0xd2,       /* xorpd    xmm2, xmm2 */
+		0xf2, 0x0f, 0xc2, 0xd1, 0x04, /* cmpneqsd xmm2, xmm1 */
+		0xf2, 0x0f, 0x5e, 0xc1,       /* divsd    xmm0, xmm1 */
+		0x66, 0x0f, 0x54, 0xc2        /* andpd    xmm0, xmm2 */
+	};
+	const unsigned char MOVSD_RSI[] = { 0xf2, 0x0f, 0x10, 0x86 };
+	const unsigned char CALL_RAX[] = { 0xff, 0xd0 };
+	double (*fnc)(double);
+	uint64_t bits;
+
+	if (PARSER_DAG_VAR == dag->op) {
+		emit(e, MOVSD_RSI, sizeof (MOVSD_RSI));
+		emit_u32(e, slot(dag->var));
+		store(e, dag->id);
+	}
+	else if (PARSER_DAG_VAL == dag->op) {
+		memcpy(&bits, &dag->val, sizeof (bits));
+		emit(e, MOVABS_RAX, sizeof (MOVABS_RAX));
+		emit_u64(e, bits);
+		emit_rsp(e, MOV_M_RAX, sizeof (MOV_M_RAX), 0, slot(dag->id));
+		e->last = 0;
+	}
+	else if (PARSER_DAG_NEG == dag->op) {
+		emit_rsp(e, MOV_RAX_M, sizeof (MOV_RAX_M), 0, slot(dag->right->id));
+		emit(e, BTC_RAX_63, sizeof (BTC_RAX_63));
+		emit_rsp(e, MOV_M_RAX, sizeof (MOV_M_RAX), 0, slot(dag->id));
+		e->last = 0;
+	}
+	else if ((fnc = intrinsic(dag->op))) {
+		load(e, 0, dag->right->id);
+		emit(e, MOVABS_RAX, sizeof (MOVABS_RAX));
+		emit_u64(e, (uint64_t)(size_t)fnc);
+		emit(e, CALL_RAX, sizeof (CALL_RAX));
+		/* mov rdi, [rsp + save]; mov rsi, [rsp + save + 8] */
+		emit_rsp(e, MOV_RAX_M, sizeof (MOV_RAX_M), 7, e->save);
+		emit_rsp(e, MOV_RAX_M, sizeof (MOV_RAX_M), 6, e->save + 8);
+		store(e, dag->id);
+	}
+	else if (PARSER_DAG_MUL == dag->op) {
+		load(e, 0, dag->left->id);
+		emit_rsp(e, MULSD, sizeof (MULSD), 0, slot(dag->right->id));
+		store(e, dag->id);
+	}
+	else if (PARSER_DAG_DIV == dag->op) {
+		/* t = r ? (l / r) : 0.0, branch-free via a compare mask */
+		load(e, 0, dag->left->id);
+		load(e, 1, dag->right->id);
+		emit(e, GUARDED_DIV, sizeof (GUARDED_DIV));
+		store(e, dag->id);
+	}
+	else if (PARSER_DAG_ADD == dag->op) {
+		load(e, 0, dag->left->id);
+		emit_rsp(e, ADDSD, sizeof (ADDSD), 0, slot(dag->right->id));
+		store(e, dag->id);
+	}
+	else if (PARSER_DAG_SUB == dag->op) {
+		load(e, 0, dag->left->id);
+		emit_rsp(e, SUBSD, sizeof (SUBSD), 0, slot(dag->right->id));
+		store(e, dag->id);
+	}
+	else {
+		EXIT("software");
+	}
+}
+
+static void
+generate(struct emitter *e,
+	 const struct parser_dag *dag,
+	 const struct parser_dag **order,
+	 uint32_t frame)
+{
+	const unsigned char SUB_RSP[] = { 0x48, 0x81, 0xec };
+	const unsigned char ADD_RSP[] = { 0x48, 0x81, 0xc4 };
+	const unsigned char OR_M8[] = { 0x80 };
+	const unsigned char ZERO[] = { 0x00 };
+	const unsigned char JMP_RDI[] = { 0xff, 0xe7 };
+	const unsigned char MOV_M_REG[] = { 0x48, 0x89 };
+	uint32_t off;
+	int i;
+
+	/* prologue: reserve the frame, touching it a page at a time */
+
+	emit(e, SUB_RSP, sizeof (SUB_RSP));
+	emit_u32(e, frame);
+	for (off=frame; off > PAGE; off-=PAGE) {
+		emit_rsp(e, OR_M8, sizeof (OR_M8), 1, off - PAGE);
+		emit(e, ZERO, sizeof (ZERO));
+	}
+	e->save = slot(dag->id + 1);
+	emit_rsp(e, MOV_M_REG, sizeof (MOV_M_REG), 7, e->save);
+	emit_rsp(e, MOV_M_REG, sizeof (MOV_M_REG), 6, e->save + 8);
+
+	/* body: each distinct node once, children before parents */
+
+	for (i=0; i<dag->id; ++i) {
+		reflect(e, order[i]);
+	}
+
+	/* epilogue: return sigmoid(root) */
+
+	load(e, 0, dag->id);
+	emit(e, ADD_RSP, sizeof (ADD_RSP));
+	emit_u32(e, frame);
+	emit(e, JMP_RDI, sizeof (JMP_RDI));
+}
+
+struct x64 *
+x64_open(const struct parser_dag *dag)
+{
+	const struct parser_dag **order;
+	struct emitter e;
+	struct x64 *x64;
+	size_t frame;
+
+	assert( dag );
+
+	frame = 8 * ((size_t)dag->id + 3);
+	frame = ((frame + 15) & ~(size_t)15) + 8; /* rsp + 8 was aligned */
+	if (MAX_FRAME < frame) {
+		TRACE("expression too large for x64 backend");
+		return NULL;
+	}
+	if (!(order = malloc((size_t)dag->id * sizeof (order[0])))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	parser_order(dag, order);
+	memset(&e, 0, sizeof (struct emitter));
+	generate(&e, dag, order, (uint32_t)frame);
+	FREE(order);
+	if (e.error) {
+		FREE(e.buf);
+		TRACE(0);
+		return NULL;
+	}
+	if (!(x64 = malloc(sizeof (struct x64)))) {
+		FREE(e.buf);
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(x64, 0, sizeof (struct x64));
+	x64->size = (e.size + PAGE - 1) & ~(size_t)(PAGE - 1);
+	x64->code = mmap(NULL,
+			 x64->size,
+			 PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS,
+			 -1,
+			 0);
+	if (MAP_FAILED == x64->code) {
+		x64->code = NULL;
+		x64_close(x64);
+		FREE(e.buf);
+		TRACE("mmap()");
+		return NULL;
+	}
+	memcpy(x64->code, e.buf, e.size);
+	FREE(e.buf);
+	if (mprotect(x64->code, x64->size, PROT_READ | PROT_EXEC)) {
+		x64_close(x64);
+		TRACE("mprotect()");
+		return NULL;
+	}
+	return x64;
+}
+
+void
+x64_close(struct x64 *x64)
+{
+	if (x64) {
+		if (x64->code) {
+			munmap(x64->code, x64->size);
+		}
+		memset(x64, 0, sizeof (struct x64));
+	}
+	FREE(x64);
+}
+
+long
+x64_lookup(const struct x64 *x64, const char *symbol)
+{
+	assert( x64 );
+
+	if (strcmp(symbol, "evaluate")) {
+		TRACE("Symbol Address Was Not Found");
+		return 0;
+	}
+	return (long)x64->code;
+}
@@ -0,0 +1,52 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * x64.h
+ */
+
+#ifndef _X64_H_
+#define _X64_H_
+
+#include "parser.h"
+
+struct x64;
+
+/**
+ * Translates dag directly into x86-64 SSE2 machine code, bypassing gcc. The
+ * code is emitted into a private mapping that is made executable (and no
+ * longer writable) before it is handed out.
+ *
+ * dag: the expression previously obtained by calling parser_dag()
+ *
+ * return: an opaque handle or NULL on error (e.g. the expression is too
+ *         large for the stack frame of the emitted function)
+ */
+
+struct x64 *x64_open(const struct parser_dag *dag);
+
+/**
+ * Releases the machine code associated with x64.
+ *
+ * x64: an opaque handle previously obtained by calling x64_open()
+ *
+ * Note: x64 may be NULL
+ */
+
+void x64_close(struct x64 *x64);
+
+/**
+ * Searches for a symbol in the machine code associated with x64. The only
+ * symbol is "evaluate", with the same signature as the one generated for
+ * jitc_compile().
+ *
+ * x64: an opaque handle previously obtained by calling x64_open()
+ *
+ * return: the memory address of the start of the symbol, or 0 on error
+ */
+
+long x64_lookup(const struct x64 *x64, const char *symbol);
+
+#endif /* _X64_H_ */
@@ -0,0 +1,239 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * bench.c
+ */
+
+#define _GNU_SOURCE
+#undef _FORTIFY_SOURCE
+
+#include <setjmp.h>
+#include "../context.h"
+#include "../scheduler.h"
+#include "../system.h"
+
+/**
+ * Measures the latency of switching between user threads: a bare
+ * switch_context() against the setjmp()/longjmp() pair the scheduler used
+ * to switch with, then a whole scheduler_yield() round trip in each mode,
+ * and the lifetime of a thread that returns at once, with its stack from the
+ * pool or freshly mapped. Reports the best of
+ * several runs, in ns per switch (yield: per scheduler_yield() call, i.e.,
+ * two switches and a scheduling decision; create: per thread).
+ *
+ * usage: bench [-n switches] [-t threads]
+ */
+
+#define RUNS 5
+#define STACK (64 * 1024)
+
+static struct {
+	struct context main;
+	struct context peer;
+	jmp_buf main_jb;
+	jmp_buf peer_jb;
+	uint64_t n; /* yields per thread */
+} bench;
+
+static uint64_t
+ns_time(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+		TRACE("clock_gettime()");
+		return 0;
+	}
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void
+peer_switch(void *arg)
+{
+	UNUSED(arg);
+	for (;;) {
+		switch_context(&bench.peer, &bench.main);
+	}
+}
+
+static void
+peer_jump(void *arg)
+{
+	UNUSED(arg);
+	for (;;) {
+		if (!setjmp(bench.peer_jb)) {
+			longjmp(bench.main_jb, 1);
+		}
+	}
+}
+
+static void
+yielder(void *arg)
+{
+	uint64_t i;
+
+	UNUSED(arg);
+	for (i=0; i<bench.n; ++i) {
+		scheduler_yield();
+	}
+}
+
+/**
+ * Ping-pongs n times with a peer on its own stack, returning ns per switch.
+ */
+
+static double
+pingpong(int jump, uint64_t n, void *stack)
+{
+	volatile uint64_t i;
+	uint64_t t;
+
+	context_init(&bench.peer,
+		     stack,
+		     STACK,
+		     jump ? peer_jump : peer_switch,
+		     NULL);
+	if (jump) {
+		/* the peer is started once, then it is setjmp()/longjmp() only */
+		if (!setjmp(bench.main_jb)) {
+			switch_context(&bench.main, &bench.peer);
+		}
+		t = ns_time();
+		for (i=0; i<n; ++i) {
+			if (!setjmp(bench.main_jb)) {
+				longjmp(bench.peer_jb, 1);
+			}
+		}
+		t = ns_time() - t;
+	}
+	else {
+		t = ns_time();
+		for (i=0; i<n; ++i) {
+			switch_context(&bench.main, &bench.peer);
+		}
+		t = ns_time() - t;
+	}
+	return (double)t / (double)(2 * n);
+}
+
+/**
+ * Creates, runs and tears down n threads, wave threads at a time, returning
+ * ns per thread. Past the first wave, stacks are recycled from the pool.
+ */
+
+static double
+creates(uint64_t n, uint64_t wave)
+{
+	uint64_t i, j, t;
+
+	bench.n = 0;
+	t = ns_time();
+	for (i=0; i<n; i+=wave) {
+		for (j=0; j<wave; ++j) {
+			if (scheduler_create(yielder, NULL)) {
+				EXIT("scheduler_create()");
+			}
+		}
+		scheduler_execute();
+	}
+	t = ns_time() - t;
+	return (double)t / (double)n;
+}
+
+/**
+ * Yields n times on each of threads user threads, returning ns per yield.
+ */
+
+static double
+yields(int mn, uint64_t n, int threads)
+{
+	uint64_t t;
+	int i;
+
+	bench.n = n;
+	for (i=0; i<threads; ++i) {
+		if (scheduler_create(yielder, NULL)) {
+			EXIT("scheduler_create()");
+		}
+	}
+	t = ns_time();
+	if (mn) {
+		if (scheduler_execute_mn(1)) {
+			EXIT("scheduler_execute_mn()");
+		}
+	}
+	else {
+		scheduler_execute();
+	}
+	t = ns_time() - t;
+	return (double)t / (double)(n * (uint64_t)threads);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char * const NAMES[] = {
+		"switch_context",
+		"setjmp/longjmp",
+		"yield",
+		"yield (M:N)",
+		"create",
+		"create (fresh)"
+	};
+	double best[ARRAY_SIZE(NAMES)], ns;
+	uint64_t n;
+	void *stack;
+	int i, j, threads;
+
+	n = 1000000;
+	threads = 4;
+	for (i=1; (i + 1) < argc; i+=2) {
+		if (!strcmp(argv[i], "-n")) {
+			n = strtoul(argv[i + 1], NULL, 10);
+		}
+		else if (!strcmp(argv[i], "-t")) {
+			threads = atoi(argv[i + 1]);
+		}
+		else {
+			break;
+		}
+	}
+	if ((i != argc) || (100 > n) || (0 >= threads)) {
+		printf("usage: %s [-n switches] [-t threads]\n", argv[0]);
+		return -1;
+	}
+	if (!(stack = malloc(STACK))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	for (j=0; j<(int)ARRAY_SIZE(NAMES); ++j) {
+		best[j] = 0.0;
+	}
+	for (i=0; i<RUNS; ++i) {
+		for (j=0; j<(int)ARRAY_SIZE(NAMES); ++j) {
+			if (2 > j) {
+				ns = pingpong(j, n, stack);
+			}
+			else if (4 > j) {
+				ns = yields(3 == j, n / (uint64_t)threads, threads);
+			}
+			else if (4 == j) {
+				ns = creates(n / 10, 64);
+			}
+			else {
+				/* more than the pool keeps idle: mostly new mappings */
+				ns = creates(n / 100, n / 100);
+			}
+			best[j] = (!i || (ns < best[j])) ? ns : best[j];
+		}
+	}
+	printf("%-16s %12s\n", "switch", "ns");
+	for (j=0; j<(int)ARRAY_SIZE(NAMES); ++j) {
+		printf("%-16s %12.1f\n", NAMES[j], best[j]);
+	}
+	FREE(stack);
+	return 0;
+}
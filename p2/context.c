@@ -0,0 +1,110 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * context.c
+ */
+
+#include "context.h"
+
+/**
+ * Needs:
+ *   x86-64 System V
+ */
+
+/**
+ * switch_context(from, to): pushes the callee-saved registers and, in one
+ * more slot, the MXCSR (low half) and the x87 control word, stores the
+ * stack pointer in from->rsp, then does the reverse from to->rsp, jumping
+ * back into whoever last switched away from to. That is a pop and an
+ * indirect jmp rather than a ret: the ret would never return to the call
+ * it pairs with and so would always miss the return stack buffer. ldmxcsr
+ * and fldcw are serializing, and the control words rarely differ between
+ * threads, so each is only reloaded when it does.
+ *
+ * context_trampoline: where a context prepared by context_init() first
+ * jumps to, with fnc in rbx and arg in r12. The stack is realigned to 16
+ * bytes for the call, and fnc has nowhere to return to.
+ */
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverlength-strings"
+
+__asm__(".text\n"
+	".globl switch_context\n"
+	".type switch_context, @function\n"
+	"switch_context:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	subq $8, %rsp\n"
+	"	stmxcsr (%rsp)\n"
+	"	fnstcw 4(%rsp)\n"
+	"	movl (%rsp), %eax\n"
+	"	movzwl 4(%rsp), %edx\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq (%rsi), %rsp\n"
+	"	cmpl (%rsp), %eax\n"
+	"	je 1f\n"
+	"	ldmxcsr (%rsp)\n"
+	"1:	cmpw 4(%rsp), %dx\n"
+	"	je 2f\n"
+	"	fldcw 4(%rsp)\n"
+	"2:	addq $8, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	popq %rcx\n"
+	"	jmp *%rcx\n"
+	".size switch_context, .-switch_context\n"
+	".globl context_trampoline\n"
+	".hidden context_trampoline\n"
+	".type context_trampoline, @function\n"
+	"context_trampoline:\n"
+	"	movq %r12, %rdi\n"
+	"	andq $-16, %rsp\n"
+	"	call *%rbx\n"
+	"	ud2\n"
+	".size context_trampoline, .-context_trampoline\n");
+
+#pragma GCC diagnostic pop
+
+void context_trampoline(void);
+
+void
+context_init(struct context *ctx,
+	     void *stack,
+	     size_t size,
+	     context_fnc_t fnc,
+	     void *arg)
+{
+	uint64_t *sp;
+	uint32_t mxcsr;
+	uint16_t fpucw;
+
+	assert( ctx && stack && fnc );
+
+	/* the frame switch_context() pops, under a 16 byte aligned top */
+
+	sp = (uint64_t *)(((uintptr_t)stack + size) & ~(uintptr_t)15);
+	*--sp = 0; /* no return address below the trampoline */
+	*--sp = (uint64_t)(uintptr_t)context_trampoline;
+	*--sp = 0; /* rbp, ends backtraces */
+	*--sp = (uint64_t)(uintptr_t)fnc; /* rbx */
+	*--sp = (uint64_t)(uintptr_t)arg; /* r12 */
+	*--sp = 0; /* r13 */
+	*--sp = 0; /* r14 */
+	*--sp = 0; /* r15 */
+	__asm__ volatile("stmxcsr %0" : "=m"(mxcsr));
+	__asm__ volatile("fnstcw %0" : "=m"(fpucw));
+	*--sp = (uint64_t)mxcsr | ((uint64_t)fpucw << 32);
+	ctx->rsp = sp;
+}
@@ -0,0 +1,56 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * context.h
+ */
+
+#ifndef _CONTEXT_H_
+#define _CONTEXT_H_
+
+#include "system.h"
+
+/**
+ * A suspended flow of execution on its own stack. Only its stack pointer is
+ * kept here: whatever the x86-64 System V ABI asks a callee to preserve
+ * (rbx, rbp, r12-r15, the MXCSR and the x87 control word) is pushed on that
+ * stack by switch_context(). Everything else is dead across a call anyway.
+ */
+
+struct context {
+	void *rsp;
+};
+
+typedef void (*context_fnc_t)(void *arg);
+
+/**
+ * Prepares ctx so that the first switch_context() to it calls fnc(arg) on
+ * the given stack, with the MXCSR and x87 control word of the caller. fnc
+ * must not return; it ends by switching away for good.
+ *
+ * ctx  : the context to prepare
+ * stack: the lowest address of the stack
+ * size : the size of the stack in bytes
+ * fnc  : the first function of the new flow of execution
+ * arg  : passed to fnc
+ */
+
+void context_init(struct context *ctx,
+		  void *stack,
+		  size_t size,
+		  context_fnc_t fnc,
+		  void *arg);
+
+/**
+ * Saves the calling flow of execution in from and resumes to. Returns when
+ * another switch_context() resumes from.
+ *
+ * from: receives the caller's context
+ * to  : a context saved by switch_context() or prepared by context_init()
+ */
+
+void switch_context(struct context *from, const struct context *to);
+
+#endif /* _CONTEXT_H_ */
@@ -24,12 +24,20 @@ _thread_(void *arg)
 	}
 }
 
+/**
+ * usage: cs238 [-m workers]
+ *
+ * With -m, the threads run in M:N mode on workers kernel threads (0 for one
+ * per CPU), see scheduler_execute_mn().
+ */
+
 int
 main(int argc, char *argv[])
 {
-	UNUSED(argc);
-	UNUSED(argv);
-
+	if ((1 != argc) && ((3 != argc) || strcmp(argv[1], "-m"))) {
+		printf("usage: %s [-m workers]\n", argv[0]);
+		return -1;
+	}
 	if (scheduler_create(_thread_, "hello") ||
 	    scheduler_create(_thread_, "world") ||
 	    scheduler_create(_thread_, "love") ||
@@ -38,6 +46,13 @@ main(int argc, char *argv[])
 		TRACE(0);
 		return -1;
 	}
+	if (3 == argc) {
+		if (scheduler_execute_mn(atoi(argv[2]))) {
+			TRACE(0);
+			return -1;
+		}
+		return 0;
+	}
 	scheduler_execute();
 	return 0;
 }
@@ -7,27 +7,34 @@
  * scheduler.c
  */
 
-#undef _FORTIFY_SOURCE
+#define _GNU_SOURCE
 
 #include <unistd.h>
 #include <signal.h>
-#include <setjmp.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <pthread.h>
 #include "system.h"
+#include "context.h"
+#include "stack.h"
 #include "scheduler.h"
-#include <signal.h>
 
 /**
  * Needs:
- *   setjmp()
- *   longjmp()
+ *   switch_context()
+ *   stack_acquire()
+ *   sigaction()
+ *   pthread_create()
+ *   pthread_cond_wait()
+ *   pthread_getspecific()
  */
 
 /* research the above Needed API and design accordingly */
 
 struct Thread
 {
-    /* The Jump Buffer For Our Thread */
-    jmp_buf ctx;
+    /* The Saved Context Of Our Thread */
+    struct context ctx;
 
     enum
     {
@@ -43,14 +50,8 @@ struct Thread
     /* Argument to be passed to the function */
     void *arg;
 
-    /* Stack of the thread */
-    struct
-    {
-        /* All Memory Allocated To The Thread's Stack */
-        void *memory_;
-        /* Page Aligned Memory */
-        void *memory;
-    } stack;
+    /* Stack of the thread, from the pool, see stack.h */
+    struct stack *stack;
 
     /* Next Thread In Line */
     struct Thread *linked_thread;
@@ -62,9 +63,69 @@ static struct
     struct Thread *head;
     struct Thread *current_thread;
     struct Thread *tail;
-    jmp_buf ctx;
+    /* The Context Of The Scheduling Loop */
+    struct context ctx;
+    /* Set while a thread runs, so that a late SIGALRM is ignored */
+    volatile sig_atomic_t in_thread;
+    /* Threads stopped by SIGALRM, anywhere, e.g. inside malloc() */
+    volatile sig_atomic_t preempted;
+    /* Terminated threads still on the list, see schedule() */
+    int dead;
 } state;
 
+/* M:N mode, see scheduler_execute_mn() */
+
+/* A ring of threads, replaced by one twice the size when full */
+struct Deque_array
+{
+    long size; /* a power of two */
+    struct Deque_array *retired; /* the smaller one it replaced */
+    struct Thread *buf[1];
+};
+
+/* A Chase-Lev work-stealing deque: the owner pushes at the bottom and
+   everyone, owner included, takes from the top */
+struct Deque
+{
+    long top;
+    char pad_[64 - sizeof (long)]; /* top and bottom on separate lines */
+    long bottom;
+    struct Deque_array *array;
+};
+
+struct Worker
+{
+    struct Deque deque;
+    /* The Context Of The Worker's Scheduling Loop */
+    struct context ctx;
+    /* The user thread running on this worker */
+    struct Thread *current;
+    pthread_t pthread;
+    unsigned long seed; /* for picking victims */
+};
+
+/* Failed attempts at finding a thread before a worker parks */
+#define MN_SPINS 64
+
+static struct
+{
+    struct Worker *workers;
+    int count;
+    /* User threads not yet terminated */
+    long live;
+    /* The worker of the calling kernel thread */
+    pthread_key_t key;
+    int active;
+    /* Parked Workers, And Wakeups Granted To Them But Not Yet Taken */
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int idle;
+    int wakes;
+} mn;
+
+static int mn_spawn(struct Thread *thread);
+static void preempt(int signum);
+
 /**
  * Creates a new user thread.
  *
@@ -75,38 +136,42 @@ static struct
  */
 int scheduler_create(scheduler_fnc_t fnc, void *arg)
 {
-    size_t page_size_v;
+    return scheduler_create_stack(fnc, arg, SCHEDULER_STACK);
+}
 
-    /* Allocate 1MB Memory to the thread */
-    struct Thread *thread = malloc(1024 * 1024);
+/**
+ * Same as scheduler_create(), with a stack of at least stack_size bytes.
+ */
+int scheduler_create_stack(scheduler_fnc_t fnc, void *arg, size_t stack_size)
+{
+    struct Thread *thread = malloc(sizeof (struct Thread));
 
     if (!thread)
     {
         TRACE("scheduler_create: Thread : Memory Full");
+        return -1;
     }
-    
-
-    page_size_v = page_size();
 
     thread->thread_status = STATUS_;
     thread->fnc = fnc;
     thread->arg = arg;
 
-    /* Allocate Memory To Stack */
-    thread->stack.memory_ = malloc(3 * page_size_v);
-
-    if (!thread->stack.memory_)
+    /* A Recycled Stack If One Is Idle, Committed By The Kernel On Use */
+    if (!(thread->stack = stack_acquire(stack_size)))
     {
-        TRACE("scheduler_create: Thread Stack :Memory Full");
+        TRACE("scheduler_create: Thread Stack");
         FREE(thread);
-        thread = NULL;
+        return -1;
     }
-    
 
-    /* Page Align the memory */
-    thread->stack.memory = memory_align(thread->stack.memory_, page_size_v);
     thread->linked_thread = NULL;
 
+    /* Created by a user thread in M:N mode: run it on the same worker */
+    if (mn.active)
+    {
+        return mn_spawn(thread);
+    }
+
     /* Manage Linked List Of Threads */
     if (state.head == NULL)
     {
@@ -137,16 +202,32 @@ int scheduler_create(scheduler_fnc_t fnc, void *arg)
  */
 void scheduler_execute(void)
 {
-    /* Set Scheduler Jump Buffer */
-    setjmp(state.ctx);
-    /* Register Signal handler */
-    signal(SIGALRM, (void (*)(int))scheduler_yield);   
-    /* Call the Signal Handler after 1 second */
-    alarm(1);
-    /* Schedule Next Thread */
-    schedule();
+    struct sigaction action;
+    struct itimerval timer;
+
+    /* Register Signal handler, which may switch away and come back later,
+       so it must not leave SIGALRM blocked meanwhile */
+    memset(&action, 0, sizeof (action));
+    action.sa_handler = preempt;
+    action.sa_flags = SA_NODEFER;
+    sigaction(SIGALRM, &action, NULL);
+    /* Preempt Every Second, Armed Once So That Switches Make No System Calls */
+    memset(&timer, 0, sizeof (timer));
+    timer.it_interval.tv_sec = 1;
+    timer.it_value.tv_sec = 1;
+    setitimer(ITIMER_REAL, &timer, NULL);
+    /* Schedule Threads Until All Have Terminated */
+    while (schedule())
+    {
+    }
+    memset(&timer, 0, sizeof (timer));
+    setitimer(ITIMER_REAL, &timer, NULL);
     /* Kill All Threads */
-    destroy();
+    if (state.head)
+    {
+        destroy();
+    }
+    state.dead = 0;
 }
 
 /**
@@ -158,9 +239,7 @@ struct Thread *thread_candidate(void)
     struct Thread *head_thread = state.head;
     struct Thread *next_thread;
 
-    /* Enters the if block twice */
-    /* Once when all threads have status STATUS_ */
-    /* Second time when all threads are terminated and we free their memory */
+    /* Enters the if block when no thread has run yet, or all have ended */
     if (state.current_thread == NULL)
     {
         /* Handle the situation when all threads except the last have been freed */
@@ -180,7 +259,7 @@ struct Thread *thread_candidate(void)
 
         /* If the next thread is not terminated, return it */
         /* Else loop until we get the first thread which is not terminated and return it */
-        /* Or else return null if all threads have been terminated */
+        /* Or else the current thread again, or null if all threads have been terminated */
         while (next_thread != state.current_thread)
         {
             if (next_thread->thread_status != STATUS_TERMINATED)
@@ -194,49 +273,141 @@ struct Thread *thread_candidate(void)
             }
         }
 
+        if (state.current_thread->thread_status != STATUS_TERMINATED)
+        {
+            return state.current_thread;
+        }
         return NULL;
     }
 }
 
 /**
- * Executes the thread
+ * The first function of every thread, on its own stack
+ */
+static void thread_main(void *arg)
+{
+    struct Thread *thread = (struct Thread *)arg;
+
+    state.in_thread = 1;
+    /* Calls the associated function */
+    thread->fnc(thread->arg);
+
+    /* The Thread has completed executing, never to be resumed */
+    state.in_thread = 0;
+    thread->thread_status = STATUS_TERMINATED;
+    switch_context(&thread->ctx, &state.ctx);
+}
+
+/**
+ * Unlinks a terminated thread, given the one before it, and recycles its
+ * stack
+ */
+static void unlink_thread(struct Thread *previous, struct Thread *thread)
+{
+    if (thread->linked_thread == thread)
+    {
+        state.head = state.tail = state.current_thread = NULL;
+    }
+    else
+    {
+        previous->linked_thread = thread->linked_thread;
+        if (state.head == thread)
+        {
+            state.head = thread->linked_thread;
+        }
+        if (state.tail == thread)
+        {
+            state.tail = previous;
+        }
+        if (state.current_thread == thread)
+        {
+            state.current_thread = previous;
+        }
+    }
+    stack_release(thread->stack);
+    FREE(thread);
+}
+
+/**
+ * Unlinks every terminated thread left on the list
+ */
+static void reap(void)
+{
+    struct Thread *previous = state.tail;
+    struct Thread *thread;
+
+    while (state.dead)
+    {
+        thread = previous->linked_thread;
+        if (thread->thread_status == STATUS_TERMINATED)
+        {
+            unlink_thread(previous, thread);
+            --state.dead;
+        }
+        else
+        {
+            previous = thread;
+        }
+    }
+}
+
+/**
+ * Runs the next thread until it yields, is preempted or terminates
+ *
+ * return: 1 if a thread ran, 0 once all threads have terminated
  */
-void schedule(void)
+int schedule(void)
 {
+    /* With no terminated thread left on the list, the candidate follows
+       the current thread (or the tail, at first) */
+    struct Thread *previous = state.current_thread ? state.current_thread
+                                                   : state.tail;
 
     /* Get Candidate Thread From The List */
     struct Thread *thread = thread_candidate();
 
     if (NULL == thread)
     {
-        return;
+        return 0;
     }
 
-    /* When the thread is newly created */
+    /* When the thread is newly created, it starts in thread_main() */
     if (thread->thread_status == STATUS_)
     {
-        /* x86_64 assembly instruction to assign the top of the thread stack to the rsp register (stack pointer). */
-        uint64_t rsp = (uint64_t)thread->stack.memory;
-        __asm__ volatile("mov %[rs], %%rsp \n"
-                         : [rs] "+r"(rsp)::);
-
         thread->thread_status = STATUS_RUNNING;
-        /* Calls the associated function */
-        thread->fnc(thread->arg);
-
-        /* The Thread has completed executing */
-        thread->thread_status = STATUS_TERMINATED;
-        
-        /* After Thread has terminated, revert back the scheduler jump buffer */
-        longjmp(state.ctx, 0);
+        context_init(&thread->ctx,
+                     thread->stack->memory,
+                     thread->stack->size,
+                     thread_main,
+                     thread);
     }
 
-    /* Restore Thread Jump Buffer */
-    longjmp(state.current_thread->ctx, 1);
+    switch_context(&state.ctx, &thread->ctx);
+
+    /* Done: unlink it and recycle its stack now, not once all are done.
+       Unless a preempted thread may be inside the stack pool, malloc() or
+       scheduler_create() itself: then it waits on the list, skipped by
+       thread_candidate(), until no thread is stopped that way */
+    if (thread->thread_status == STATUS_TERMINATED)
+    {
+        if (state.preempted || state.dead)
+        {
+            ++state.dead;
+        }
+        else
+        {
+            unlink_thread(previous, thread);
+        }
+    }
+    if (state.dead && !state.preempted)
+    {
+        reap();
+    }
+    return 1;
 }
 
 /**
- * Frees all memory allocated to the threads
+ * Frees all memory allocated to the threads, their stacks back to the pool
 */
 void destroy(void)
 {
@@ -262,7 +433,7 @@ void destroy(void)
 
         state.current_thread = NULL;
 
-        FREE(head_thread->stack.memory_);
+        stack_release(head_thread->stack);
         FREE(head_thread);
 
         head_thread = next_thread;
@@ -279,16 +450,446 @@ void destroy(void)
  */
 void scheduler_yield(void)
 {
-    /* Reset The Alarm */
-    alarm(0);
-    /* Set Thread Jump Buffer */
-    if (setjmp(state.current_thread->ctx))
+    struct Worker *worker;
+
+    /* M:N: back to the worker's scheduling loop, which requeues us */
+    if (mn.active)
+    {
+        worker = pthread_getspecific(mn.key);
+        if (worker && worker->current)
+        {
+            switch_context(&worker->current->ctx, &worker->ctx);
+        }
+        return;
+    }
+
+    /* Not in a thread, e.g. a SIGALRM that fired in the scheduling loop */
+    if (!state.in_thread)
+    {
+        return;
+    }
+    /* Save The Thread, Back To The Scheduling Loop Until It Is Picked Again */
+    state.in_thread = 0;
+    switch_context(&state.current_thread->ctx, &state.ctx);
+    state.in_thread = 1;
+}
+
+/**
+ * The SIGALRM handler: preempts the running thread
+ */
+static void preempt(int signum)
+{
+    UNUSED(signum);
+    if (state.in_thread)
+    {
+        ++state.preempted;
+        scheduler_yield();
+        --state.preempted;
+    }
+}
+
+/**
+ * Allocates an empty deque array of size entries.
+ */
+static struct Deque_array *deque_array(long size)
+{
+    struct Deque_array *array;
+
+    array = malloc(sizeof (struct Deque_array) +
+                   (size_t)(size - 1) * sizeof (struct Thread *));
+    if (!array)
+    {
+        TRACE("deque_array: Memory Full");
+        return NULL;
+    }
+    array->size = size;
+    array->retired = NULL;
+    return array;
+}
+
+/**
+ * Replaces a full array by one twice the size. Thieves may still be
+ * reading the old one, so it is only freed with the deque.
+ */
+static struct Deque_array *deque_grow(struct Deque *deque,
+                                      struct Deque_array *array,
+                                      long top,
+                                      long bottom)
+{
+    struct Deque_array *bigger;
+    long i;
+
+    if (!(bigger = deque_array(2 * array->size)))
+    {
+        return NULL;
+    }
+    for (i = top; i < bottom; ++i)
+    {
+        bigger->buf[i & (bigger->size - 1)] =
+            __atomic_load_n(&array->buf[i & (array->size - 1)],
+                            __ATOMIC_RELAXED);
+    }
+    bigger->retired = array;
+    __atomic_store_n(&deque->array, bigger, __ATOMIC_RELEASE);
+    return bigger;
+}
+
+/**
+ * Appends a thread at the bottom. Only the owner of the deque pushes.
+ *
+ * return: 0 on success, otherwise error
+ */
+static int deque_push(struct Deque *deque, struct Thread *thread)
+{
+    struct Deque_array *array;
+    long top, bottom;
+
+    bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    array = __atomic_load_n(&deque->array, __ATOMIC_RELAXED);
+    if (bottom - top > array->size - 1)
+    {
+        if (!(array = deque_grow(deque, array, top, bottom)))
+        {
+            return -1;
+        }
+    }
+    __atomic_store_n(&array->buf[bottom & (array->size - 1)],
+                     thread,
+                     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * Removes the thread at the top, the one waiting the longest.
+ *
+ * return: the thread, or NULL if the deque is empty or another worker won
+ *         the race for it
+ */
+static struct Thread *deque_steal(struct Deque *deque)
+{
+    struct Deque_array *array;
+    struct Thread *thread;
+    long top, bottom;
+
+    top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom)
+    {
+        return NULL;
+    }
+    array = __atomic_load_n(&deque->array, __ATOMIC_ACQUIRE);
+    thread = __atomic_load_n(&array->buf[top & (array->size - 1)],
+                             __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&deque->top,
+                                     &top,
+                                     top + 1,
+                                     0,
+                                     __ATOMIC_SEQ_CST,
+                                     __ATOMIC_RELAXED))
+    {
+        return NULL;
+    }
+    return thread;
+}
+
+static void deque_free(struct Deque *deque)
+{
+    struct Deque_array *array;
+
+    while ((array = deque->array))
+    {
+        deque->array = array->retired;
+        FREE(array);
+    }
+}
+
+/**
+ * Called after pushing on the deque of a worker: if it now holds more than
+ * the worker's next thread, lets a parked worker come and steal. Every
+ * queued thread is on the deque of a running worker, so a wakeup that is
+ * missed only costs parallelism, never progress.
+ */
+static void mn_wake(struct Worker *worker)
+{
+    if (!__atomic_load_n(&mn.idle, __ATOMIC_RELAXED) ||
+        (2 > __atomic_load_n(&worker->deque.bottom, __ATOMIC_RELAXED) -
+             __atomic_load_n(&worker->deque.top, __ATOMIC_RELAXED)))
     {
         return;
     }
-    /* When a thread is supposed to yield to another thread, revert back the scheduler jump buffer */
+    pthread_mutex_lock(&mn.mutex);
+    if (mn.wakes < mn.idle)
+    {
+        ++mn.wakes;
+        pthread_cond_signal(&mn.cond);
+    }
+    pthread_mutex_unlock(&mn.mutex);
+}
+
+/**
+ * Sleeps until woken by mn_wake(), or until every user thread has
+ * terminated.
+ */
+static void mn_park(void)
+{
+    pthread_mutex_lock(&mn.mutex);
+    ++mn.idle;
+    while (__atomic_load_n(&mn.live, __ATOMIC_ACQUIRE) && !mn.wakes)
+    {
+        pthread_cond_wait(&mn.cond, &mn.mutex);
+    }
+    if (mn.wakes)
+    {
+        --mn.wakes;
+    }
+    --mn.idle;
+    pthread_mutex_unlock(&mn.mutex);
+}
+
+/**
+ * Queues a thread created by a running user thread on its worker.
+ */
+static int mn_spawn(struct Thread *thread)
+{
+    struct Worker *worker;
+
+    if (!(worker = pthread_getspecific(mn.key)))
+    {
+        TRACE("scheduler_create: only user threads create threads in M:N mode");
+        stack_release(thread->stack);
+        FREE(thread);
+        return -1;
+    }
+    __atomic_add_fetch(&mn.live, 1, __ATOMIC_RELAXED);
+    if (deque_push(&worker->deque, thread))
+    {
+        __atomic_sub_fetch(&mn.live, 1, __ATOMIC_RELAXED);
+        stack_release(thread->stack);
+        FREE(thread);
+        return -1;
+    }
+    mn_wake(worker);
+    return 0;
+}
+
+/**
+ * The first frame of every user thread in M:N mode. The worker is looked up
+ * again after fnc returns since the thread may have been stolen meanwhile.
+ */
+static void mn_start(void *arg)
+{
+    struct Thread *thread = (struct Thread *)arg;
+    struct Worker *worker;
+
+    thread->fnc(thread->arg);
+
+    worker = pthread_getspecific(mn.key);
+    thread->thread_status = STATUS_TERMINATED;
+    switch_context(&thread->ctx, &worker->ctx);
+}
+
+/**
+ * Runs a thread on the worker until it yields or terminates, then requeues
+ * or frees it.
+ */
+static void mn_run(struct Worker *worker, struct Thread *thread)
+{
+    if (STATUS_ == thread->thread_status)
+    {
+        thread->thread_status = STATUS_RUNNING;
+        context_init(&thread->ctx,
+                     thread->stack->memory,
+                     thread->stack->size,
+                     mn_start,
+                     thread);
+    }
+    worker->current = thread;
+    switch_context(&worker->ctx, &thread->ctx);
+
+    /* Back from the thread: it yielded or terminated */
+    worker->current = NULL;
+    if (STATUS_TERMINATED == thread->thread_status)
+    {
+        stack_release(thread->stack);
+        FREE(thread);
+        /* The last one: wake the parked workers, so that they exit */
+        if (!__atomic_sub_fetch(&mn.live, 1, __ATOMIC_ACQ_REL))
+        {
+            pthread_mutex_lock(&mn.mutex);
+            pthread_cond_broadcast(&mn.cond);
+            pthread_mutex_unlock(&mn.mutex);
+        }
+    }
+    else if (deque_push(&worker->deque, thread))
+    {
+        EXIT("scheduler: Memory Full");
+    }
     else
     {
-        longjmp(state.ctx, 1);
+        mn_wake(worker);
     }
-}
\ No newline at end of file
+}
+
+/**
+ * Returns the next thread for a worker: from the top of its own deque, so
+ * its threads take turns, else stolen from another worker's, trying the
+ * others once each from a random one.
+ */
+static struct Thread *mn_next(struct Worker *worker)
+{
+    struct Thread *thread;
+    int i, victim;
+
+    if ((thread = deque_steal(&worker->deque)))
+    {
+        return thread;
+    }
+    worker->seed = worker->seed * 6364136223846793005UL + 1442695040888963407UL;
+    victim = (int)((worker->seed >> 33) % (unsigned long)mn.count);
+    for (i = 0; i < mn.count; ++i, victim = (victim + 1) % mn.count)
+    {
+        if ((&mn.workers[victim] != worker) &&
+            (thread = deque_steal(&mn.workers[victim].deque)))
+        {
+            return thread;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * The scheduling loop of a worker, until every user thread has terminated.
+ * A worker that keeps finding nothing to run parks rather than spin.
+ */
+static void *mn_worker(void *arg)
+{
+    struct Worker *worker = (struct Worker *)arg;
+    struct Thread *thread;
+    int fails = 0;
+
+    if (pthread_setspecific(mn.key, worker))
+    {
+        EXIT("pthread_setspecific()");
+    }
+    while (__atomic_load_n(&mn.live, __ATOMIC_ACQUIRE))
+    {
+        if ((thread = mn_next(worker)))
+        {
+            fails = 0;
+            mn_run(worker, thread);
+        }
+        else if (MN_SPINS > ++fails)
+        {
+            /* Every thread is running elsewhere: let them have the core */
+            sched_yield();
+        }
+        else
+        {
+            /* Still nothing: sleep until there is something to steal */
+            fails = 0;
+            mn_park();
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Called to execute the user threads previously created by calling
+ * scheduler_create() on several kernel threads, see scheduler.h.
+ */
+int scheduler_execute_mn(int workers)
+{
+    struct Thread *thread, *next;
+    long cpus;
+    int i, n;
+
+    if (0 >= workers)
+    {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = (0 < cpus) ? (int)cpus : 1;
+    }
+    if (!(mn.workers = malloc((size_t)workers * sizeof (struct Worker))))
+    {
+        TRACE("scheduler_execute_mn: Memory Full");
+        return -1;
+    }
+    memset(mn.workers, 0, (size_t)workers * sizeof (struct Worker));
+    mn.count = workers;
+    for (i = 0; i < workers; ++i)
+    {
+        mn.workers[i].seed = (unsigned long)i + 1;
+        if (!(mn.workers[i].deque.array = deque_array(64)))
+        {
+            while (i--)
+            {
+                deque_free(&mn.workers[i].deque);
+            }
+            FREE(mn.workers);
+            return -1;
+        }
+    }
+    if (pthread_key_create(&mn.key, NULL))
+    {
+        for (i = 0; i < workers; ++i)
+        {
+            deque_free(&mn.workers[i].deque);
+        }
+        FREE(mn.workers);
+        TRACE("pthread_key_create()");
+        return -1;
+    }
+
+    pthread_mutex_init(&mn.mutex, NULL);
+    pthread_cond_init(&mn.cond, NULL);
+    mn.idle = mn.wakes = 0;
+
+    /* Deal the created threads out to the workers, round-robin */
+    thread = state.head;
+    for (i = 0; thread; ++i)
+    {
+        next = (thread == state.tail) ? NULL : thread->linked_thread;
+        thread->linked_thread = NULL;
+        if (deque_push(&mn.workers[i % workers].deque, thread))
+        {
+            EXIT("scheduler: Memory Full");
+        }
+        ++mn.live;
+        thread = next;
+    }
+    state.head = state.tail = state.current_thread = NULL;
+
+    /* The caller is worker 0 */
+    mn.active = 1;
+    for (n = 1; n < workers; ++n)
+    {
+        if (pthread_create(&mn.workers[n].pthread,
+                           NULL,
+                           mn_worker,
+                           &mn.workers[n]))
+        {
+            TRACE("pthread_create(): continuing with fewer workers");
+            break;
+        }
+    }
+    mn_worker(&mn.workers[0]);
+    for (i = 1; i < n; ++i)
+    {
+        pthread_join(mn.workers[i].pthread, NULL);
+    }
+    mn.active = 0;
+
+    pthread_cond_destroy(&mn.cond);
+    pthread_mutex_destroy(&mn.mutex);
+    pthread_key_delete(mn.key);
+    for (i = 0; i < workers; ++i)
+    {
+        deque_free(&mn.workers[i].deque);
+    }
+    FREE(mn.workers);
+    mn.count = 0;
+    return 0;
+}
@@ -10,6 +10,15 @@
 #ifndef _SCHEDULER_H_
 #define _SCHEDULER_H_
 
+#include <stddef.h>
+
+/**
+ * The default stack size of a user thread in bytes. Only the pages a
+ * thread touches are committed, so this costs address space, not memory.
+ */
+
+#define SCHEDULER_STACK (64 * 1024)
+
 /**
  * scheduler_fnc_t defines the signature of the user thread function to
  * be scheduled by the scheduler. The user thread function will be supplied
@@ -29,6 +38,21 @@ typedef void (*scheduler_fnc_t)(void *arg);
 
 int scheduler_create(scheduler_fnc_t fnc, void *arg);
 
+/**
+ * Same as scheduler_create(), for a thread that needs a stack other than
+ * SCHEDULER_STACK. Stacks come from a pool and go back to it when their
+ * thread terminates; each has a guard page below it, so that a thread
+ * overflowing its stack faults (SIGSEGV) instead of corrupting memory.
+ *
+ * fnc       : the start function of the user thread (see scheduler_fnc_t)
+ * arg       : a pass-through pointer defining the context of the user thread
+ * stack_size: the least usable stack size in bytes
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int scheduler_create_stack(scheduler_fnc_t fnc, void *arg, size_t stack_size);
+
 /**
  * Called to execute the user threads previously created by calling
  * scheduler_create().
@@ -43,18 +67,37 @@ int scheduler_create(scheduler_fnc_t fnc, void *arg);
 
 void scheduler_execute(void);
 
+/**
+ * Same as scheduler_execute(), but M:N: the user threads run on several
+ * kernel threads, the caller being one of them. Each worker runs the
+ * threads of its own run deque in turn, a yielding thread going to the
+ * back, and a worker with nothing to run steals from the others, or
+ * sleeps until there is something to steal. User threads must therefore
+ * yield (there is no preemption in this mode) and may resume on a
+ * different worker than they yielded on. Threads created by user threads
+ * start on the creator's worker.
+ *
+ * workers: the number of worker threads, or 0 for one per online CPU
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int scheduler_execute_mn(int workers);
+
 /**
  * Called from within a user thread to yield the CPU to another user thread.
  */
 void scheduler_yield(void);
 
 /**
- * Executes the thread
+ * Runs the next thread until it yields, is preempted or terminates
+ *
+ * return: 1 if a thread ran, 0 once all threads have terminated
  */
-void schedule(void);
+int schedule(void);
 
 /**
- * Frees all memory allocated to the threads
+ * Frees all memory allocated to the threads, their stacks back to the pool
 */
 void destroy(void);
 
@@ -0,0 +1,162 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * stack.c
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <pthread.h>
+#include "stack.h"
+
+/**
+ * Needs:
+ *   mmap()
+ *   mprotect()
+ *   madvise()
+ *   pthread_mutex_lock()
+ */
+
+#define CLASSES 32 /* up to 2^31 pages usable */
+#define IDLE 256   /* idle stacks kept per class */
+
+/**
+ * A mapping is the guard page, then 2^class pages, then one more page whose
+ * last bytes hold this header, so that a pooled stack needs no other
+ * allocation. The stack grows down from just below the header, so that
+ * page is the stack's first anyway, and the class is that of the usable
+ * bytes: a stack of 2^k pages takes 2^k + 2 pages of address space.
+ */
+
+struct block {
+	struct stack stack;
+	struct block *next;
+	int class;
+};
+
+static struct {
+	struct block *idle[CLASSES];
+	int count[CLASSES];
+} pool;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct block *
+map(int class)
+{
+	struct block *block;
+	size_t page, size;
+	char *memory;
+
+	page = page_size();
+	size = (page << class) + page;
+	memory = mmap(NULL,
+		      page + size,
+		      PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+		      -1,
+		      0);
+	if (MAP_FAILED == memory) {
+		TRACE("mmap()");
+		return NULL;
+	}
+	if (mprotect(memory, page, PROT_NONE)) {
+		munmap(memory, page + size);
+		TRACE("mprotect()");
+		return NULL;
+	}
+	block = (struct block *)(memory + page + size) - 1;
+	block->stack.memory = memory + page;
+	block->stack.size = (size - sizeof (struct block)) & ~(size_t)15;
+	block->next = NULL;
+	block->class = class;
+	return block;
+}
+
+/**
+ * Gives the pages a released stack has dirtied back to the kernel, all but
+ * the one holding the header. MADV_FREE only reclaims them under memory
+ * pressure, so a stack recycled before that keeps them without faulting.
+ */
+
+static void
+discard(struct block *block)
+{
+	size_t size;
+
+	size = page_size() << block->class;
+#ifdef MADV_FREE
+	if (!madvise(block->stack.memory, size, MADV_FREE)) {
+		return;
+	}
+#endif
+	if (madvise(block->stack.memory, size, MADV_DONTNEED)) {
+		TRACE("madvise()");
+	}
+}
+
+static void
+unmap(struct block *block)
+{
+	size_t page;
+
+	page = page_size();
+	if (munmap((char *)block->stack.memory - page,
+		   page + (page << block->class) + page)) {
+		TRACE("munmap()");
+	}
+}
+
+struct stack *
+stack_acquire(size_t size)
+{
+	struct block *block;
+	size_t page;
+	int class;
+
+	page = page_size();
+	class = 0;
+	while ((page << class) < size) {
+		if (CLASSES <= ++class) {
+			TRACE("stack too large");
+			return NULL;
+		}
+	}
+	pthread_mutex_lock(&lock);
+	if ((block = pool.idle[class])) {
+		pool.idle[class] = block->next;
+		--pool.count[class];
+	}
+	pthread_mutex_unlock(&lock);
+	if (!block && !(block = map(class))) {
+		return NULL;
+	}
+	block->next = NULL;
+	return &block->stack;
+}
+
+void
+stack_release(struct stack *stack)
+{
+	struct block *block;
+
+	if (stack) {
+		block = (struct block *)stack;
+		discard(block);
+		pthread_mutex_lock(&lock);
+		if (IDLE > pool.count[block->class]) {
+			block->next = pool.idle[block->class];
+			pool.idle[block->class] = block;
+			++pool.count[block->class];
+			block = NULL;
+		}
+		pthread_mutex_unlock(&lock);
+		if (block) {
+			unmap(block);
+		}
+	}
+}
@@ -0,0 +1,49 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * stack.h
+ */
+
+#ifndef _STACK_H_
+#define _STACK_H_
+
+#include "system.h"
+
+/**
+ * A stack for a user thread, from a process-wide pool. Each one is its own
+ * mapping, with a PROT_NONE guard page just below memory, so that running
+ * off the end of it faults rather than silently corrupting a neighbour.
+ * Its pages are only committed by the kernel as they are first touched.
+ */
+
+struct stack {
+	void *memory; /* lowest usable address */
+	size_t size;  /* usable bytes, at least those asked for */
+};
+
+/**
+ * Returns a stack of at least size bytes, recycling one released earlier
+ * when one of the same size class (a power of two pages) is idle, mapping
+ * a new one otherwise. Thread-safe.
+ *
+ * size: the number of usable bytes needed
+ *
+ * return: the stack, or NULL on error
+ */
+
+struct stack *stack_acquire(size_t size);
+
+/**
+ * Returns a stack to the pool for a later stack_acquire(), its dirty
+ * pages to the kernel; beyond a few idle stacks per size class it is
+ * unmapped instead. Thread-safe.
+ *
+ * stack: a stack obtained by calling stack_acquire(), or NULL
+ */
+
+void stack_release(struct stack *stack);
+
+#endif /* _STACK_H_ */